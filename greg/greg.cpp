@@ -32,26 +32,89 @@
 
 #include "atom.h"
 #include "msg_data.h"
+#include "slot_table.h"
+#include "snapshot.h"
+#include "stats.h"
 #include "ext.h"
+#include "ext_obex.h"
+#include "ext_dictionary.h"
 #include <cassert>
 #include <sstream>
+#include <vector>
 
 typedef struct _greg {
     t_object obj;
     t_outlet* outlet;
+    t_outlet* info_outlet;
     void* proxy;
     long in;
     t_object* editor;
     t_msg_data data;
+    t_slot_table slots;
     bool dirty;
+
+    // chunked output
+    t_atom_long chunk_size;
+    double chunk_interval;
+    t_msg_data stream;
+    size_t stream_pos;
+    void* stream_clock;
+
+    char embed;
+
+    // coalescing input
+    char coalesce;
+    double coalesce_interval;
+    bool coalesce_pending;
+    void* coalesce_clock;
+
+    // instrumentation
+    t_mem_stats mem;
+    int64_t stores;
+    int64_t outputs;
+    double serialize_ms;
+    double parse_ms;
+    double stats_time;      // when the rates were last queried
+    int64_t stats_stores;
+    int64_t stats_outputs;
 } t_greg;
 
+// totals for `getstats all`
+struct t_greg_totals {
+    std::atomic<int64_t> instances{0};
+    std::atomic<int64_t> stores{0};
+    std::atomic<int64_t> outputs{0};
+};
+
+static t_greg_totals s_greg_totals;
+
 void* greg_new(t_symbol* s, long argc, t_atom* argv);
 void greg_free(t_greg* x);
 void greg_int(t_greg* x, long l);
 void greg_float(t_greg* x, double f);
 void greg_gimme(t_greg* x, t_symbol* s, long argc, t_atom* argv);
 void greg_bang(t_greg* x);
+void greg_stored(t_greg* x);
+void greg_coalesce_tick(t_greg* x);
+void greg_output(t_greg* x);
+void greg_stop(t_greg* x);
+void greg_stream_start(t_greg* x);
+void greg_stream_tick(t_greg* x);
+void greg_store(t_greg* x, t_symbol* s, long argc, t_atom* argv);
+t_atom* greg_copy_slot(t_greg* x, const t_slot* slot);
+void greg_recall(t_greg* x, t_symbol* key);
+void greg_delete(t_greg* x, t_symbol* key);
+void greg_dump(t_greg* x);
+void greg_write(t_greg* x, t_symbol* s);
+void greg_dowrite(t_greg* x, t_symbol* s);
+void greg_read(t_greg* x, t_symbol* s);
+void greg_doread(t_greg* x, t_symbol* s);
+bool greg_load_snapshot(t_greg* x, const char* buf, size_t len);
+void greg_appendtodictionary(t_greg* x, t_dictionary* d);
+void greg_count_store(t_greg* x);
+void greg_count_output(t_greg* x);
+void greg_outlet_stat(t_greg* x, const char* name, double value);
+void greg_getstats(t_greg* x, t_symbol* s);
 void greg_dblclick(t_greg* x);
 void greg_edclose(t_greg* x, char* *ht, long size);
 void greg_assist(t_greg* x, void* b, long m, long a, char* s);
@@ -66,11 +129,40 @@ void ext_main(void* r) {
     class_addmethod(c, (method)greg_gimme,      "anything",     A_GIMME,    0);
     class_addmethod(c, (method)greg_gimme,      "list",         A_GIMME,    0);
     class_addmethod(c, (method)greg_bang,       "bang",         A_CANT,     0);
+    class_addmethod(c, (method)greg_stop,       "stop",                     0);
+    class_addmethod(c, (method)greg_store,      "store",        A_GIMME,    0);
+    class_addmethod(c, (method)greg_recall,     "recall",       A_SYM,      0);
+    class_addmethod(c, (method)greg_delete,     "delete",       A_SYM,      0);
+    class_addmethod(c, (method)greg_dump,       "dump",                     0);
+    class_addmethod(c, (method)greg_write,      "write",        A_DEFSYM,   0);
+    class_addmethod(c, (method)greg_read,       "read",         A_DEFSYM,   0);
+    class_addmethod(c, (method)greg_appendtodictionary, "appendtodictionary", A_CANT, 0);
+    class_addmethod(c, (method)greg_getstats,   "getstats",     A_DEFSYM,   0);
     class_addmethod(c, (method)greg_dblclick,   "dblclick",     A_CANT,     0);
     class_addmethod(c, (method)greg_edclose,    "edclose",      A_CANT,     0);
     class_addmethod(c, (method)greg_okclose,    "okclose",      A_CANT,     0);
     class_addmethod(c, (method)greg_assist,     "assist",       A_CANT,     0);
     class_addmethod(c, (method)stdinletinfo,    "inletinfo",    A_CANT,     0);
+
+    CLASS_ATTR_LONG(c, "chunksize", 0, t_greg, chunk_size);
+    CLASS_ATTR_FILTER_MIN(c, "chunksize", 0);
+    CLASS_ATTR_LABEL(c, "chunksize", 0, "Chunk Size (0 = output whole list)");
+
+    CLASS_ATTR_DOUBLE(c, "chunkinterval", 0, t_greg, chunk_interval);
+    CLASS_ATTR_FILTER_MIN(c, "chunkinterval", 0);
+    CLASS_ATTR_LABEL(c, "chunkinterval", 0, "Interval Between Chunks (ms)");
+
+    CLASS_ATTR_CHAR(c, "embed", 0, t_greg, embed);
+    CLASS_ATTR_STYLE_LABEL(c, "embed", 0, "onoff", "Save Data With Patcher");
+    CLASS_ATTR_SAVE(c, "embed", 0);
+
+    CLASS_ATTR_CHAR(c, "coalesce", 0, t_greg, coalesce);
+    CLASS_ATTR_STYLE_LABEL(c, "coalesce", 0, "onoff", "Coalesce Input");
+
+    CLASS_ATTR_DOUBLE(c, "coalesceinterval", 0, t_greg, coalesce_interval);
+    CLASS_ATTR_FILTER_MIN(c, "coalesceinterval", 0);
+    CLASS_ATTR_LABEL(c, "coalesceinterval", 0, "Minimum Time Between Coalesced Outputs (ms)");
+
     class_register(CLASS_BOX, c);
     s_greg_class = c;
 }
@@ -78,29 +170,71 @@ void ext_main(void* r) {
 void* greg_new(t_symbol* s, long argc, t_atom* argv) {
     t_greg* x = (t_greg*)object_alloc(s_greg_class);
     x->proxy = proxy_new((t_object*) x, 1, &x->in);
-    x->outlet = outlet_new(x, nullptr);
+    x->info_outlet = (t_outlet*)outlet_new(x, nullptr);
+    x->outlet = (t_outlet*)outlet_new(x, nullptr);
     x->editor = nullptr;
-    msg_data_init(&x->data);
+    mem_stats_init(&x->mem);
+    x->stores = 0;
+    x->outputs = 0;
+    x->serialize_ms = 0;
+    x->parse_ms = 0;
+    x->stats_time = systimer_gettime();
+    x->stats_stores = 0;
+    x->stats_outputs = 0;
+    s_greg_totals.instances++;
+
+    msg_data_init(&x->data, &x->mem);
+    slot_table_init(&x->slots, &x->mem);
     x->dirty = false;
 
+    x->chunk_size = 0;
+    x->chunk_interval = 0;
+    msg_data_init(&x->stream, &x->mem);
+    x->stream_pos = 0;
+    x->stream_clock = clock_new(x, (method)greg_stream_tick);
+
+    x->embed = 0;
+
+    x->coalesce = 0;
+    x->coalesce_interval = 0;
+    x->coalesce_pending = false;
+    x->coalesce_clock = clock_new(x, (method)greg_coalesce_tick);
+
+    attr_args_process(x, argc, argv);
+
+    // restore data embedded in the patcher
+    t_dictionary* d = object_dictionaryarg(argc, argv);
+    const char* snapshot = nullptr;
+    if(d && dictionary_getstring(d, gensym("greg_snapshot"), &snapshot) == MAX_ERR_NONE) {
+        std::vector<char> buf = snapshot_decode_base64(snapshot);
+        if(!greg_load_snapshot(x, buf.data(), buf.size())) {
+            object_error((t_object*)x, "couldn't restore the data saved with the patcher");
+        }
+    }
+
     return x;
 }
 
 void greg_free(t_greg* x) {
     sysmem_freeptr(x->proxy);
+    freeobject((t_object*)x->stream_clock);
+    freeobject((t_object*)x->coalesce_clock);
     msg_data_free(&x->data);
+    msg_data_free(&x->stream);
+    slot_table_free(&x->slots);
+    s_greg_totals.instances--;
 }
 
 void greg_int(t_greg* x, long l) {
-    // msg_data_set(&x->data, l);
-    msg_data_set_long(&x->data, l);
-    greg_bang(x);
+    msg_data_set(&x->data, l);
+    greg_count_store(x);
+    greg_stored(x);
 }
 
 void greg_float(t_greg* x, double f) {
-    // msg_data_set(&x->data, f);
-    msg_data_set_float(&x->data, f);
-    greg_bang(x);
+    msg_data_set(&x->data, f);
+    greg_count_store(x);
+    greg_stored(x);
 }
 
 /*
@@ -116,7 +250,8 @@ void greg_float(t_greg* x, double f) {
  */
 void greg_gimme(t_greg*x, t_symbol* s, long argc, t_atom* argv) {
     msg_data_set_list_or_anything(&x->data, s, argc, argv);
-    greg_bang(x);
+    greg_count_store(x);
+    greg_stored(x);
 }
 
 void greg_bang(t_greg* x) {
@@ -125,7 +260,339 @@ void greg_bang(t_greg* x) {
         return;
     }
 
-    msg_data_outlet(&x->data, x->outlet);
+    greg_output(x);
+}
+
+/*
+ * called whenever new data has been stored
+ *
+ * with @coalesce 1, data arriving in the left inlet is still stored right
+ * away, but output is deferred to a single clock: at most one output per
+ * @coalesceinterval ms (0 = per scheduler pass), always with the latest data.
+ *
+ */
+void greg_stored(t_greg* x) {
+    if(!x->coalesce) {
+        greg_bang(x);
+        return;
+    }
+
+    if(proxy_getinlet((t_object*)x) != 0 || x->coalesce_pending) {
+        return;
+    }
+
+    x->coalesce_pending = true;
+    clock_fdelay(x->coalesce_clock, x->coalesce_interval);
+}
+
+void greg_coalesce_tick(t_greg* x) {
+    x->coalesce_pending = false;
+    greg_output(x);
+}
+
+void greg_output(t_greg* x) {
+    greg_count_output(x);
+    if(x->chunk_size > 0 && x->data.type == A_GIMME) {
+        greg_stream_start(x);
+    } else {
+        msg_data_outlet(&x->data, x->outlet);
+    }
+}
+
+/*
+ * chunked output
+ *
+ * with @chunksize > 0, lists are sent out in chunks of at most `chunk_size`
+ * atoms, one chunk per @chunkinterval ms, framed by `start` and `end`.
+ * the stored data is copied when the stream starts so that new input doesn't
+ * tear the running output. outputting again restarts the stream, `stop`
+ * aborts it. the right outlet bangs once the last chunk has been sent.
+ *
+ */
+void greg_stream_start(t_greg* x) {
+    clock_unset(x->stream_clock);
+    msg_data_copy(&x->stream, &x->data);
+    x->stream_pos = 0;
+
+    outlet_anything(x->outlet, gensym("start"), 0, nullptr);
+    greg_stream_tick(x);
+}
+
+void greg_stream_tick(t_greg* x) {
+    if(x->stream_pos >= x->stream.size) {
+        return;
+    }
+
+    size_t count = MIN((size_t)x->chunk_size, x->stream.size - x->stream_pos);
+    size_t pos = x->stream_pos;
+    x->stream_pos += count;
+    msg_data_outlet_range(&x->stream, x->outlet, pos, count);
+
+    if(x->stream_pos < x->stream.size) {
+        clock_fdelay(x->stream_clock, x->chunk_interval);
+    } else {
+        outlet_anything(x->outlet, gensym("end"), 0, nullptr);
+        outlet_bang(x->info_outlet);
+    }
+}
+
+void greg_stop(t_greg* x) {
+    clock_unset(x->stream_clock);
+    x->stream_pos = x->stream.size;
+}
+
+/*
+ * keyed slots
+ *
+ * `store key ...` keeps the rest of the message under `key` without touching
+ * the main register, `recall key` outputs it. lets one greg replace a whole
+ * bank of gregs behind a [route].
+ *
+ */
+void greg_store(t_greg* x, t_symbol* s, long argc, t_atom* argv) {
+    if(argc < 2 || atom_gettype(argv) != A_SYM) {
+        object_error((t_object*)x, "store: expects a key followed by the data to store");
+        return;
+    }
+
+    slot_table_store(&x->slots, atom_getsym(argv), argc - 1, argv + 1);
+    greg_count_store(x);
+}
+
+// copies the atoms of a slot to a scratch buffer for output. whatever is
+// connected to the outlet may store into or delete from the table, which
+// moves the slots and the arena. pop the buffer after the output
+t_atom* greg_copy_slot(t_greg* x, const t_slot* slot) {
+    t_atom* atoms = _msg_data_scratch_push(slot->size);
+    if(slot->size) {
+        memcpy(atoms, slot_table_atoms(&x->slots, slot), slot->size * sizeof(t_atom));
+    }
+    return atoms;
+}
+
+void greg_recall(t_greg* x, t_symbol* key) {
+    t_slot* slot = slot_table_find(&x->slots, key);
+    if(!slot) {
+        object_error((t_object*)x, "recall: no slot named %s", key->s_name);
+        return;
+    }
+
+    greg_count_output(x);
+    e_max_atomtypes type = slot->type;
+    size_t size = slot->size;
+    t_atom* atoms = greg_copy_slot(x, slot);
+    msg_data_outlet_atoms(x->outlet, type, size, atoms);
+    _msg_data_scratch_pop();
+}
+
+void greg_delete(t_greg* x, t_symbol* key) {
+    if(!slot_table_delete(&x->slots, key)) {
+        object_error((t_object*)x, "delete: no slot named %s", key->s_name);
+    }
+}
+
+// outputs every slot as `key ...`, in table order. the keys are collected
+// first, so slots that are stored or deleted downstream during the dump
+// don't derail it: deleted ones are skipped, new ones aren't output
+void greg_dump(t_greg* x) {
+    std::vector<t_symbol*> keys;
+    keys.reserve(x->slots.count);
+    for(size_t i=0; i<x->slots.capacity; i++) {
+        if(x->slots.slots[i].key != nullptr) {
+            keys.push_back(x->slots.slots[i].key);
+        }
+    }
+
+    for(t_symbol* key : keys) {
+        t_slot* slot = slot_table_find(&x->slots, key);
+        if(!slot) {
+            continue;
+        }
+        size_t size = slot->size;
+        t_atom* atoms = greg_copy_slot(x, slot);
+        outlet_anything(x->outlet, key, size, atoms);
+        _msg_data_scratch_pop();
+    }
+}
+
+/*
+ * persistence
+ *
+ * the contents (register and slots) are saved as a binary snapshot, see
+ * snapshot.h. with @embed 1 the snapshot is saved with the patcher,
+ * `write`/`read` save and load it as a separate file.
+ *
+ */
+bool greg_load_snapshot(t_greg* x, const char* buf, size_t len) {
+    t_msg_data data;
+    t_slot_table slots;
+    msg_data_init(&data, &x->mem);
+    slot_table_init(&slots, &x->mem);
+
+    if(!snapshot_read(buf, len, &data, &slots)) {
+        msg_data_free(&data);
+        slot_table_free(&slots);
+        return false;
+    }
+
+    msg_data_free(&x->data);
+    slot_table_free(&x->slots);
+    x->data = data;
+    x->slots = slots;
+    return true;
+}
+
+void greg_appendtodictionary(t_greg* x, t_dictionary* d) {
+    if(!x->embed) {
+        return;
+    }
+
+    std::vector<char> buf = snapshot_write(&x->data, &x->slots);
+    dictionary_appendstring(d, gensym("greg_snapshot"), snapshot_encode_base64(buf).c_str());
+}
+
+void greg_write(t_greg* x, t_symbol* s) {
+    defer_low(x, (method)greg_dowrite, s, 0, nullptr);
+}
+
+void greg_dowrite(t_greg* x, t_symbol* s) {
+    char filename[MAX_PATH_CHARS];
+    short path;
+    t_fourcc type = 0;
+
+    if(s == gensym("")) {
+        strncpy_zero(filename, "untitled.greg", MAX_PATH_CHARS);
+        if(saveasdialog_extended(filename, &path, &type, nullptr, 0)) {
+            return;
+        }
+    } else {
+        strncpy_zero(filename, s->s_name, MAX_PATH_CHARS);
+        path = path_getdefault();
+    }
+
+    t_filehandle fh;
+    if(path_createsysfile(filename, path, type, &fh)) {
+        object_error((t_object*)x, "write: couldn't create %s", filename);
+        return;
+    }
+
+    std::vector<char> buf = snapshot_write(&x->data, &x->slots);
+    t_ptr_size count = buf.size();
+    if(sysfile_write(fh, &count, buf.data()) != MAX_ERR_NONE) {
+        object_error((t_object*)x, "write: couldn't write %s", filename);
+    }
+    sysfile_seteof(fh, count);
+    sysfile_close(fh);
+}
+
+void greg_read(t_greg* x, t_symbol* s) {
+    defer_low(x, (method)greg_doread, s, 0, nullptr);
+}
+
+void greg_doread(t_greg* x, t_symbol* s) {
+    char filename[MAX_PATH_CHARS];
+    short path;
+    t_fourcc type;
+
+    if(s == gensym("")) {
+        if(open_dialog(filename, &path, &type, nullptr, 0)) {
+            return;
+        }
+    } else {
+        strncpy_zero(filename, s->s_name, MAX_PATH_CHARS);
+        if(locatefile_extended(filename, &path, &type, nullptr, 0)) {
+            object_error((t_object*)x, "read: couldn't find %s", s->s_name);
+            return;
+        }
+    }
+
+    t_filehandle fh;
+    if(path_opensysfile(filename, path, &fh, READ_PERM)) {
+        object_error((t_object*)x, "read: couldn't open %s", filename);
+        return;
+    }
+
+    // one read for the whole file, the snapshot is parsed from memory
+    t_ptr_size size = 0;
+    sysfile_geteof(fh, &size);
+    std::vector<char> buf(size);
+    t_max_err err = sysfile_read(fh, &size, buf.data());
+    sysfile_close(fh);
+
+    if(err != MAX_ERR_NONE || !greg_load_snapshot(x, buf.data(), size)) {
+        object_error((t_object*)x, "read: %s is not a valid greg file", filename);
+    }
+}
+
+/*
+ * instrumentation
+ *
+ * `getstats` outputs this object's counters from the right outlet,
+ * `getstats all` the totals over all greg objects. each counter is output as
+ * `name value`, rates are per second since the previous query.
+ *
+ */
+void greg_count_store(t_greg* x) {
+    x->stores++;
+    s_greg_totals.stores.fetch_add(1, std::memory_order_relaxed);
+}
+
+void greg_count_output(t_greg* x) {
+    x->outputs++;
+    s_greg_totals.outputs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void greg_outlet_stat(t_greg* x, const char* name, double value) {
+    t_atom a;
+    atom_setfloat(&a, value);
+    outlet_anything(x->info_outlet, gensym(name), 1, &a);
+}
+
+void greg_getstats(t_greg* x, t_symbol* s) {
+    double now = systimer_gettime();
+
+    if(s == gensym("all")) {
+        static double s_time = 0;
+        static int64_t s_stores = 0;
+        static int64_t s_outputs = 0;
+
+        int64_t stores = s_greg_totals.stores.load();
+        int64_t outputs = s_greg_totals.outputs.load();
+        double seconds = (now - s_time) / 1000.;
+
+        greg_outlet_stat(x, "instances", s_greg_totals.instances.load());
+        greg_outlet_stat(x, "bytes", mem_totals.bytes.load());
+        greg_outlet_stat(x, "peakbytes", mem_totals.peak_bytes.load());
+        greg_outlet_stat(x, "allocs", mem_totals.allocs.load());
+        greg_outlet_stat(x, "frees", mem_totals.frees.load());
+        greg_outlet_stat(x, "scratchbytes", mem_totals.scratch_bytes.load());
+        greg_outlet_stat(x, "stores", stores);
+        greg_outlet_stat(x, "outputs", outputs);
+        greg_outlet_stat(x, "storespersec", s_time ? (stores - s_stores) / seconds : 0);
+        greg_outlet_stat(x, "outputspersec", s_time ? (outputs - s_outputs) / seconds : 0);
+
+        s_time = now;
+        s_stores = stores;
+        s_outputs = outputs;
+        return;
+    }
+
+    double seconds = (now - x->stats_time) / 1000.;
+
+    greg_outlet_stat(x, "bytes", x->mem.bytes);
+    greg_outlet_stat(x, "peakbytes", x->mem.peak_bytes);
+    greg_outlet_stat(x, "allocs", x->mem.allocs);
+    greg_outlet_stat(x, "frees", x->mem.frees);
+    greg_outlet_stat(x, "stores", x->stores);
+    greg_outlet_stat(x, "outputs", x->outputs);
+    greg_outlet_stat(x, "storespersec", seconds > 0 ? (x->stores - x->stats_stores) / seconds : 0);
+    greg_outlet_stat(x, "outputspersec", seconds > 0 ? (x->outputs - x->stats_outputs) / seconds : 0);
+    greg_outlet_stat(x, "serializems", x->serialize_ms);
+    greg_outlet_stat(x, "parsems", x->parse_ms);
+
+    x->stats_time = now;
+    x->stats_stores = x->stores;
+    x->stats_outputs = x->outputs;
 }
 
 void greg_dblclick(t_greg* x) {
@@ -139,8 +606,10 @@ void greg_dblclick(t_greg* x) {
         return;
     }
 
+    double start = systimer_gettime();
     std::stringstream stream = msg_data_to_stream(&x->data);
     object_method(x->editor, gensym("settext"), stream.str().c_str(), gensym("utf-8"));
+    x->serialize_ms = systimer_gettime() - start;
 }
 
 // adapted from bach
@@ -150,7 +619,9 @@ void greg_edclose(t_greg* x, char** ht, long size) {
         return;
     }
 
+    double start = systimer_gettime();
     msg_data_from_c_string(&x->data, *ht);
+    x->parse_ms = systimer_gettime() - start;
     x->dirty = false;
 }
 
@@ -165,7 +636,14 @@ void greg_assist(t_greg* x, void* b, long m, long a, char* s) {
                 break;
         }
     } else {
-        snprintf_zero(s, 256, "(anything) stored list");
+        switch (a) {
+            case 0:
+                snprintf_zero(s, 256, "(anything) stored list");
+                break;
+            case 1:
+                snprintf_zero(s, 256, "bang when chunked output is done, stats");
+                break;
+        }
     }
 }
 
@@ -22,43 +22,227 @@
 
 #include "ext.h"
 #include "atom.h"
+#include "stats.h"
 #include <sstream>
 #include <type_traits>
+#include <vector>
 
+/*
+ * the data is stored packed: one 8 byte `word` per element instead of a
+ * 16 byte t_atom. for homogeneous lists (all ints, all floats, all symbols)
+ * a single `elemtype` describes every element, so the values form one
+ * contiguous t_atom_long[] / double[]. mixed lists additionally keep one
+ * type tag per element in `tags`.
+ *
+ * atoms are only expanded when they are needed, i.e. for output, into a
+ * scratch buffer that is shared by all instances (see below).
+ *
+ */
 typedef struct _msg_data {
-    t_atom* atoms;
+    union word* values;
+    char* tags;                 // only valid if `elemtype` is A_NOTHING
+    e_max_atomtypes elemtype;   // type of all elements, A_NOTHING if mixed
     size_t size;
+    size_t capacity;
     e_max_atomtypes type;
+    t_mem_stats* stats;         // optional, counts allocations
 } t_msg_data;
 
-inline void msg_data_init(t_msg_data* x) {
-    x->atoms = nullptr;
+inline void msg_data_init(t_msg_data* x, t_mem_stats* stats = nullptr) {
+    x->values = nullptr;
+    x->tags = nullptr;
+    x->elemtype = A_NOTHING;
     x->size = 0;
+    x->capacity = 0;
     x->type = A_NOTHING;
+    x->stats = stats;
+}
+
+inline void _msg_data_release(t_msg_data* x) {
+    stats_freeptr(x->stats, x->values, x->capacity * sizeof(union word));
+    stats_freeptr(x->stats, x->tags, x->capacity);
 }
 
 inline void msg_data_free(t_msg_data* x) {
-    sysmem_freeptr(x->atoms);
-    x->atoms = nullptr;
-    x->size = 0;
-    x->type = A_NOTHING;
+    _msg_data_release(x);
+    msg_data_init(x, x->stats);
 }
 
+// grows the storage if needed, shrinks it once it is mostly unused
 inline void msg_data_resize(t_msg_data* x, size_t n) {
     x->size = n;
-    sysmem_freeptr(x->atoms);
-    x->atoms = (t_atom*)sysmem_newptr(n * sizeof(t_atom));
+    if(n <= x->capacity && n * 4 >= x->capacity) {
+        return;
+    }
+
+    _msg_data_release(x);
+    x->capacity = MAX(n, (size_t)1);
+    x->values = (union word*)stats_newptr(x->stats, x->capacity * sizeof(union word));
+    x->tags = nullptr;
+}
+
+// tags are only allocated once a mixed list is stored
+inline void _msg_data_alloc_tags(t_msg_data* x) {
+    if(!x->tags) {
+        x->tags = (char*)stats_newptr(x->stats, x->capacity);
+    }
+}
+
+inline e_max_atomtypes msg_data_elemtype(const t_msg_data* x, size_t i) {
+    return x->elemtype != A_NOTHING ? x->elemtype : static_cast<e_max_atomtypes>(x->tags[i]);
+}
+
+inline void msg_data_get_atom(const t_msg_data* x, size_t i, t_atom* a) {
+    a->a_type = msg_data_elemtype(x, i);
+    a->a_w = x->values[i];
+}
+
+inline size_t msg_data_bytes(const t_msg_data* x) {
+    return x->capacity * sizeof(union word) + (x->tags ? x->capacity : 0);
+}
+
+// packs `argc` atoms into `x`, starting at element `offset`
+inline void _msg_data_pack(t_msg_data* x, size_t offset, long argc, const t_atom* argv) {
+    if(!argc) {
+        return;
+    }
+
+    for(long i=0; i<argc; i++) {
+        x->values[offset + i] = argv[i].a_w;
+    }
+
+    // find out if we can get away without per-element tags
+    e_max_atomtypes type = static_cast<e_max_atomtypes>(argv[0].a_type);
+    bool homogeneous = true;
+    for(long i=1; i<argc; i++) {
+        if(argv[i].a_type != type) {
+            homogeneous = false;
+            break;
+        }
+    }
+
+    if(homogeneous && (offset == 0 || x->elemtype == type)) {
+        x->elemtype = type;
+        return;
+    }
+
+    _msg_data_alloc_tags(x);
+    if(x->elemtype != A_NOTHING) {
+        memset(x->tags, x->elemtype, offset);
+        x->elemtype = A_NOTHING;
+    }
+    for(long i=0; i<argc; i++) {
+        x->tags[offset + i] = (char)argv[i].a_type;
+    }
+}
+
+inline void msg_data_copy(t_msg_data* dst, const t_msg_data* src) {
+    msg_data_resize(dst, src->size);
+    sysmem_copyptr(src->values, dst->values, src->size * sizeof(union word));
+    dst->elemtype = src->elemtype;
+    if(src->elemtype == A_NOTHING && src->size) {
+        _msg_data_alloc_tags(dst);
+        sysmem_copyptr(src->tags, dst->tags, src->size);
+    }
+    dst->type = src->type;
+}
+
+/*
+ * scratch buffers for expanding packed data into atoms
+ *
+ * one buffer per nesting level: outputting can trigger another output (of
+ * the same or another greg) further down the patch before the first one has
+ * returned, which must not overwrite atoms that are still being used. the
+ * buffers are kept per thread, since max calls us from both the main and the
+ * scheduler thread.
+ *
+ * a buffer only keeps up to MSG_DATA_SCRATCH_KEEP atoms between outputs,
+ * anything larger is freed again right away, so a single huge list doesn't
+ * hold on to its expanded atoms forever. the buffers belong to no object,
+ * so they are counted in the totals only (`getstats all`).
+ *
+ */
+inline constexpr size_t MSG_DATA_SCRATCH_KEEP = 4096;
+
+struct t_msg_data_scratch {
+    std::vector<std::vector<t_atom>> levels;
+    size_t depth = 0;
+
+    ~t_msg_data_scratch() {
+        for(std::vector<t_atom>& level : levels) {
+            _count(level.capacity(), 0);
+        }
+    }
+
+    static void _count(size_t before, size_t after) {
+        if(before) {
+            mem_totals_free(before * sizeof(t_atom));
+            mem_totals.scratch_bytes.fetch_sub(before * sizeof(t_atom), std::memory_order_relaxed);
+        }
+        if(after) {
+            mem_totals_alloc(after * sizeof(t_atom));
+            mem_totals.scratch_bytes.fetch_add(after * sizeof(t_atom), std::memory_order_relaxed);
+        }
+    }
+};
+
+inline thread_local t_msg_data_scratch msg_data_scratch;
+
+inline t_atom* _msg_data_scratch_push(size_t n) {
+    t_msg_data_scratch& scratch = msg_data_scratch;
+    if(scratch.depth == scratch.levels.size()) {
+        scratch.levels.emplace_back();
+    }
+    std::vector<t_atom>& level = scratch.levels[scratch.depth++];
+    if(level.size() < n) {
+        size_t before = level.capacity();
+        level.resize(n);
+        if(level.capacity() != before) {
+            t_msg_data_scratch::_count(before, level.capacity());
+        }
+    }
+    return level.data();
+}
+
+inline void _msg_data_scratch_pop() {
+    t_msg_data_scratch& scratch = msg_data_scratch;
+    std::vector<t_atom>& level = scratch.levels[--scratch.depth];
+    if(level.capacity() > MSG_DATA_SCRATCH_KEEP) {
+        t_msg_data_scratch::_count(level.capacity(), 0);
+        std::vector<t_atom>().swap(level);
+    }
+}
+
+// expands `count` elements starting at `start` into `atoms`
+inline void msg_data_expand(const t_msg_data* x, size_t start, size_t count, t_atom* atoms) {
+    const union word* values = x->values + start;
+    if(x->elemtype != A_NOTHING) {
+        short type = x->elemtype;
+        for(size_t i=0; i<count; i++) {
+            atoms[i].a_type = type;
+            atoms[i].a_w = values[i];
+        }
+    } else {
+        const char* tags = x->tags + start;
+        for(size_t i=0; i<count; i++) {
+            atoms[i].a_type = tags[i];
+            atoms[i].a_w = values[i];
+        }
+    }
 }
 
 inline std::stringstream msg_data_to_stream(t_msg_data* x) {
     std::stringstream result;
 
+    t_atom a;
     if(x->type == A_LONG || x->type == A_FLOAT || x->type == A_SYM) {
         assert(x->size == 1 && "x->type should only ever be (long, float, sym) if the atoms size is also one!");
-        append_atom_to_stream(result, x->atoms);
+        msg_data_get_atom(x, 0, &a);
+        append_atom_to_stream(result, &a);
     } else if(x->type == A_GIMME) {
         for(size_t i=0; i<x->size; i++) {
-            append_atom_to_stream(result, x->atoms+i);
+            msg_data_get_atom(x, i, &a);
+            append_atom_to_stream(result, &a);
             result << " ";
         }
     }
@@ -81,16 +265,15 @@ inline void msg_data_from_c_string(t_msg_data* x, const char* parsestr) {
         return;
     }
 
-    msg_data_free(x);
-
-    x->size = size;
-    x->atoms = atoms;
+    msg_data_resize(x, size);
+    _msg_data_pack(x, 0, size, atoms);
+    sysmem_freeptr(atoms);
 
     if(x->size == 0) {          // no input (can this even happen?)
         post("DEBUG - x->greg_size is 0!");
         x->type = A_NOTHING;
     } else if(x->size == 1) {   // single element in input, just get its type
-        x->type = static_cast<e_max_atomtypes>(atom_gettype(x->atoms));
+        x->type = msg_data_elemtype(x, 0);
     } else {                    // input was a list
         x->type = A_GIMME;
     }
@@ -105,27 +288,33 @@ inline void _msg_data_set_common(t_msg_data* x, size_t n, e_max_atomtypes type)
 
 inline void msg_data_set_long(t_msg_data* x, t_atom_long value) {
     _msg_data_set_common(x, 1, A_LONG);
-    atom_setlong(x->atoms, value);
+    x->elemtype = A_LONG;
+    x->values[0].w_long = value;
 }
 
 inline void msg_data_set_float(t_msg_data* x, t_atom_float value) {
     _msg_data_set_common(x, 1, A_FLOAT);
-    atom_setfloat(x->atoms, value);
+    x->elemtype = A_FLOAT;
+    x->values[0].w_float = value;
 }
 
 inline void msg_data_set_symbol(t_msg_data* x, t_symbol* value) {
-    _msg_data_set_common(x, 1, A_FLOAT);
-    atom_setsym(x->atoms, value);
+    _msg_data_set_common(x, 1, A_SYM);
+    x->elemtype = A_SYM;
+    x->values[0].w_sym = value;
 }
 
 inline void msg_data_set_list(t_msg_data* x, long argc, t_atom* argv) {
     _msg_data_set_common(x, argc, A_GIMME);
-    atom_setlist(x->atoms, argc, argv);
+    _msg_data_pack(x, 0, argc, argv);
 }
 
 inline void msg_data_set_anything(t_msg_data* x, t_symbol* s, long argc, t_atom* argv) {
     _msg_data_set_common(x, argc + 1, A_GIMME);
-    atom_setanything(x->atoms, s, argc, argv);
+    t_atom selector;
+    atom_setsym(&selector, s);
+    _msg_data_pack(x, 0, 1, &selector);
+    _msg_data_pack(x, 1, argc, argv);
 }
 
 inline void msg_data_set_list_or_anything(t_msg_data*x, t_symbol* s, long argc, t_atom* argv) {
@@ -136,17 +325,46 @@ inline void msg_data_set_list_or_anything(t_msg_data*x, t_symbol* s, long argc,
     }
 }
 
+// outputs `size` atoms as a list, or as an anything if the first atom is a
+// symbol
+inline void msg_data_outlet_list(t_outlet* outlet, size_t size, t_atom* atoms) {
+    if(atom_gettype(atoms) == A_SYM) {
+        outlet_anything(outlet, atom_getsym(atoms), size - 1, atoms + 1);
+    } else {
+        outlet_list(outlet, nullptr, size, atoms);
+    }
+}
+
+// outputs raw atoms according to `type`, shared by everything that keeps
+// messages in the same layout as t_msg_data
+inline void msg_data_outlet_atoms(t_outlet* outlet, e_max_atomtypes type, size_t size, t_atom* atoms) {
+    if(type == A_LONG) {
+        outlet_int(outlet, atom_getlong(atoms));
+    } else if(type == A_FLOAT) {
+        outlet_float(outlet, atom_getfloat(atoms));
+    } else if(type == A_SYM) {
+        outlet_anything(outlet, atom_getsym(atoms), 0, nullptr);
+    } else if(type == A_GIMME) {
+        msg_data_outlet_list(outlet, size, atoms);
+    }
+}
+
+inline void msg_data_outlet_range(t_msg_data* x, t_outlet* outlet, size_t start, size_t count) {
+    t_atom* atoms = _msg_data_scratch_push(count);
+    msg_data_expand(x, start, count, atoms);
+    msg_data_outlet_list(outlet, count, atoms);
+    _msg_data_scratch_pop();
+}
+
 inline void msg_data_outlet(t_msg_data* x, t_outlet* outlet) {
     if(x->type == A_LONG) {
-        outlet_int(outlet, atom_getlong(x->atoms));
+        outlet_int(outlet, x->values[0].w_long);
     } else if(x->type == A_FLOAT) {
-        outlet_float(outlet, atom_getfloat(x->atoms));
+        outlet_float(outlet, x->values[0].w_float);
+    } else if(x->type == A_SYM) {
+        outlet_anything(outlet, x->values[0].w_sym, 0, nullptr);
     } else if(x->type == A_GIMME) {
-        if(atom_gettype(x->atoms) == A_SYM) {
-            outlet_anything(outlet, atom_getsym(x->atoms), x->size - 1, x->atoms + 1);
-        } else {
-            outlet_list(outlet, nullptr, x->size, x->atoms);
-        }
+        msg_data_outlet_range(x, outlet, 0, x->size);
     }
 }
 
@@ -154,77 +372,84 @@ inline void msg_data_outlet(t_msg_data* x, t_outlet* outlet) {
 
 // C++ templates for setting
 
-// handy dandy variadic template for setting the data pointer according
-// to all of the messages we support, reducing code duplication
-template <typename ... Args>
-void msg_data_set(t_msg_data* x, size_t n, e_max_atomtypes type, Args ... values) {
-    msg_data_resize(x, n);
-    atom_set(x->atoms, values...);
-    x->type = type;
-}
-
 inline void msg_data_set(t_msg_data* x, long argc, t_atom* argv) {
-    msg_data_resize(x, argc);
-    atom_set(x->atoms, argc, argv);
-    x->type = A_GIMME;
+    msg_data_set_list(x, argc, argv);
 }
 
 inline void msg_data_set(t_msg_data* x, t_symbol* s, long argc, t_atom* argv) {
-    msg_data_resize(x, argc+1);
-    atom_set(x->atoms, s, argc, argv);
-    x->type = A_GIMME;
-}
-
-void msg_data_set(t_msg_data* x, std::integral auto l) {
-    msg_data_set(x, 1, A_LONG, l);
-}
-
-void msg_data_set(t_msg_data* x, std::floating_point auto f) {
-    msg_data_set(x, 1, A_FLOAT, f);
-}
-
-inline void msg_data_set(t_msg_data* x, t_symbol* s) {
-    msg_data_set(x, 1, A_SYM, s);
-}
-
-// // TODO: tinkering around w/ automatically setting the right size and type
-// // at compile time as an exercise in template metaprogramming
-// template <typename V> concept AtomValue =
-//     std::is_integral_v<V> ||
-//     std::is_floating_point_v<V> ||
-//     std::is_same_v<V, t_symbol*>;
-//
-// template <typename V> struct AtomSize {
-//     static constexpr size_t size = 0;
-// };
-//
-// template <AtomValue V> struct AtomSize<V> {
-//     static constexpr size_t size = 1;
-// };
-//
-// template <typename ...V> struct AtomType : public AtomSize<V...> {
-//     static constexpr e_max_atomtypes type = A_NOTHING;
-// };
-//
-// // template <long size, ...V> struct AtomType : public AtomSize<> {
-// //
-// // };
-//
-// template <std::integral V> struct AtomType<V> : public AtomSize<V> {
-//     static constexpr e_max_atomtypes type = A_LONG;
-// };
-//
-// template <std::floating_point V> struct AtomType<V> : public AtomSize<V> {
-//     static constexpr e_max_atomtypes type = A_FLOAT;
-// };
-//
-// template <> struct AtomType<t_symbol*> : public AtomSize<t_symbol*> {
-//     static constexpr e_max_atomtypes type = A_SYM;
-// };
-//
-// template <AtomValue V>
-// void msg_data_set(t_msg_data* x, V value) {
-//     msg_data_set(x, AtomType<V>::size, AtomType<V>::type, value);
-// }
+    msg_data_set_anything(x, s, argc, argv);
+}
+
+// size and type of the stored message are worked out at compile time, so
+// setting scalars or lists of scalars doesn't branch on the types at runtime
+
+template <typename V> concept AtomValue =
+    std::is_integral_v<V> ||
+    std::is_floating_point_v<V> ||
+    std::is_same_v<V, t_symbol*>;
+
+template <typename V> struct AtomType;
+
+template <std::integral V> struct AtomType<V> {
+    static constexpr e_max_atomtypes type = A_LONG;
+};
+
+template <std::floating_point V> struct AtomType<V> {
+    static constexpr e_max_atomtypes type = A_FLOAT;
+};
+
+template <> struct AtomType<t_symbol*> {
+    static constexpr e_max_atomtypes type = A_SYM;
+};
+
+template <AtomValue V, AtomValue ... Rest> struct AtomPack {
+    static constexpr size_t size = 1 + sizeof...(Rest);
+    // shared element type, A_NOTHING if the types are mixed
+    static constexpr e_max_atomtypes elemtype =
+        ((AtomType<Rest>::type == AtomType<V>::type) && ...) ? AtomType<V>::type : A_NOTHING;
+    // a single value keeps its own type, anything longer is a list
+    static constexpr e_max_atomtypes type = size == 1 ? AtomType<V>::type : A_GIMME;
+};
+
+static_assert(AtomPack<int>::type == A_LONG);
+static_assert(AtomPack<bool>::type == A_LONG);
+static_assert(AtomPack<float>::type == A_FLOAT);
+static_assert(AtomPack<t_symbol*>::type == A_SYM);
+static_assert(AtomPack<long, short>::type == A_GIMME && AtomPack<long, short>::elemtype == A_LONG);
+static_assert(AtomPack<double, float>::elemtype == A_FLOAT);
+static_assert(AtomPack<int, double, t_symbol*>::size == 3);
+static_assert(AtomPack<int, double, t_symbol*>::elemtype == A_NOTHING);
+static_assert(!AtomValue<t_atom*> && !AtomValue<const char*>);
+
+inline void _msg_data_store(union word* w, std::integral auto value) {
+    w->w_long = static_cast<t_atom_long>(value);
+}
+
+inline void _msg_data_store(union word* w, std::floating_point auto value) {
+    w->w_float = static_cast<t_atom_float>(value);
+}
+
+inline void _msg_data_store(union word* w, t_symbol* value) {
+    w->w_sym = value;
+}
+
+// msg_data_set(x, 1), msg_data_set(x, 2.5) or msg_data_set(x, 1, 2.5, sym)
+template <AtomValue ... V>
+void msg_data_set(t_msg_data* x, V ... values) {
+    using Pack = AtomPack<V...>;
+
+    msg_data_resize(x, Pack::size);
+    x->type = Pack::type;
+    x->elemtype = Pack::elemtype;
+
+    union word* w = x->values;
+    (_msg_data_store(w++, values), ...);
+
+    if constexpr (Pack::elemtype == A_NOTHING) {
+        _msg_data_alloc_tags(x);
+        char* tag = x->tags;
+        ((*tag++ = AtomType<V>::type), ...);
+    }
+}
 
 #endif  // __cplusplus
@@ -0,0 +1,251 @@
+/*
+ *  slot_table.h
+ *  keyed storage for many messages in a single object
+ *
+ * Copyright (C) 2023-2025 Manolo Müller
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License
+ * as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * open addressing hash table (linear probing) keyed on `t_symbol*`.
+ * symbols are interned by max, so comparing pointers is enough.
+ *
+ * the slots only hold an offset and a size into one shared atom arena, so a
+ * slot costs 32 bytes plus its atoms, and iterating means walking two flat
+ * arrays. overwritten or deleted atoms are left in the arena as garbage and
+ * are compacted away the next time the arena has to grow.
+ *
+ */
+
+#pragma once
+
+#include "ext.h"
+#include "stats.h"
+#include <cstdint>
+#include <cstring>
+
+typedef struct _slot {
+    t_symbol* key;      // nullptr marks an empty slot
+    size_t offset;      // into the arena
+    size_t size;
+    e_max_atomtypes type;
+} t_slot;
+
+typedef struct _slot_table {
+    t_slot* slots;
+    size_t capacity;    // always a power of two
+    size_t shift;       // 64 - log2(capacity), for the hash
+    size_t count;
+    t_atom* arena;
+    size_t arena_capacity;
+    size_t arena_used;
+    size_t arena_garbage;
+    t_mem_stats* stats;     // optional, counts allocations
+} t_slot_table;
+
+inline constexpr size_t SLOT_TABLE_MIN_CAPACITY = 16;
+
+inline size_t _slot_table_hash(const t_slot_table* t, t_symbol* key) {
+    // fibonacci hashing, the lowest bits of the pointer are alignment zeros
+    return (size_t)(((uint64_t)(uintptr_t)key * 0x9E3779B97F4A7C15ull) >> t->shift);
+}
+
+inline void _slot_table_alloc(t_slot_table* t, size_t capacity) {
+    t->slots = (t_slot*)stats_newptrclear(t->stats, capacity * sizeof(t_slot));
+    t->capacity = capacity;
+    t->shift = 64;
+    for(size_t c = capacity; c > 1; c >>= 1) {
+        t->shift--;
+    }
+}
+
+inline void slot_table_init(t_slot_table* t, t_mem_stats* stats = nullptr) {
+    t->stats = stats;
+    _slot_table_alloc(t, SLOT_TABLE_MIN_CAPACITY);
+    t->count = 0;
+    t->arena = nullptr;
+    t->arena_capacity = 0;
+    t->arena_used = 0;
+    t->arena_garbage = 0;
+}
+
+inline void slot_table_free(t_slot_table* t) {
+    stats_freeptr(t->stats, t->slots, t->capacity * sizeof(t_slot));
+    stats_freeptr(t->stats, t->arena, t->arena_capacity * sizeof(t_atom));
+    t->slots = nullptr;
+    t->arena = nullptr;
+    t->capacity = 0;
+    t->count = 0;
+    t->arena_capacity = 0;
+    t->arena_used = 0;
+    t->arena_garbage = 0;
+}
+
+inline void slot_table_clear(t_slot_table* t) {
+    slot_table_free(t);
+    slot_table_init(t, t->stats);
+}
+
+inline t_slot* slot_table_find(const t_slot_table* t, t_symbol* key) {
+    size_t mask = t->capacity - 1;
+    for(size_t i = _slot_table_hash(t, key); ; i = (i + 1) & mask) {
+        t_slot* slot = t->slots + i;
+        if(slot->key == key) {
+            return slot;
+        }
+        if(slot->key == nullptr) {
+            return nullptr;
+        }
+    }
+}
+
+// returns the slot for `key`, claiming an empty one if it doesn't exist yet
+inline t_slot* _slot_table_claim(t_slot_table* t, t_symbol* key) {
+    size_t mask = t->capacity - 1;
+    for(size_t i = _slot_table_hash(t, key); ; i = (i + 1) & mask) {
+        t_slot* slot = t->slots + i;
+        if(slot->key == key) {
+            return slot;
+        }
+        if(slot->key == nullptr) {
+            slot->key = key;
+            slot->offset = 0;
+            slot->size = 0;
+            slot->type = A_NOTHING;
+            t->count++;
+            return slot;
+        }
+    }
+}
+
+// keep the load factor below 0.7, linear probing degrades quickly above that
+inline void _slot_table_grow(t_slot_table* t) {
+    if((t->count + 1) * 10 < t->capacity * 7) {
+        return;
+    }
+
+    t_slot* old = t->slots;
+    size_t old_capacity = t->capacity;
+    _slot_table_alloc(t, old_capacity * 2);
+
+    size_t mask = t->capacity - 1;
+    for(size_t j=0; j<old_capacity; j++) {
+        if(old[j].key == nullptr) {
+            continue;
+        }
+        size_t i = _slot_table_hash(t, old[j].key);
+        while(t->slots[i].key != nullptr) {
+            i = (i + 1) & mask;
+        }
+        t->slots[i] = old[j];
+    }
+
+    stats_freeptr(t->stats, old, old_capacity * sizeof(t_slot));
+}
+
+// moves all live atoms into a fresh arena with room for at least `n` more.
+// the old arena is only freed after `argv` has been copied by the caller,
+// so storing atoms that point into the arena itself stays safe.
+inline t_atom* _slot_table_rebuild_arena(t_slot_table* t, size_t n) {
+    size_t live = t->arena_used - t->arena_garbage;
+    size_t capacity = MAX(2 * (live + n), (size_t)64);
+    t_atom* arena = (t_atom*)stats_newptr(t->stats, capacity * sizeof(t_atom));
+
+    size_t used = 0;
+    for(size_t i=0; i<t->capacity; i++) {
+        t_slot* slot = t->slots + i;
+        if(slot->key == nullptr || slot->size == 0) {
+            continue;
+        }
+        memcpy(arena + used, t->arena + slot->offset, slot->size * sizeof(t_atom));
+        slot->offset = used;
+        used += slot->size;
+    }
+
+    // the old arena is accounted for as freed here already
+    t_atom* old = t->arena;
+    if(old) {
+        mem_stats_free(t->stats, t->arena_capacity * sizeof(t_atom));
+    }
+    t->arena = arena;
+    t->arena_capacity = capacity;
+    t->arena_used = used;
+    t->arena_garbage = 0;
+    return old;
+}
+
+inline t_atom* slot_table_atoms(const t_slot_table* t, const t_slot* slot) {
+    return t->arena + slot->offset;
+}
+
+// stores `argc` atoms under `key`. a single atom keeps its own type, anything
+// longer is stored as a list (or an anything if it starts with a symbol).
+inline void slot_table_store(t_slot_table* t, t_symbol* key, long argc, t_atom* argv) {
+    _slot_table_grow(t);
+    t_slot* slot = _slot_table_claim(t, key);
+
+    size_t n = (size_t)argc;
+    t_atom* old = nullptr;
+    if(n <= slot->size) {
+        // fits where the old atoms were
+        t->arena_garbage += slot->size - n;
+    } else {
+        t->arena_garbage += slot->size;
+        slot->size = 0;
+        if(t->arena_used + n > t->arena_capacity) {
+            old = _slot_table_rebuild_arena(t, n);
+        }
+        slot->offset = t->arena_used;
+        t->arena_used += n;
+    }
+
+    memmove(t->arena + slot->offset, argv, n * sizeof(t_atom));
+    slot->size = n;
+    if(n == 0) {
+        slot->type = A_NOTHING;
+    } else if(n == 1) {
+        slot->type = static_cast<e_max_atomtypes>(atom_gettype(argv));
+    } else {
+        slot->type = A_GIMME;
+    }
+
+    sysmem_freeptr(old);
+}
+
+// backward shift deletion, so lookups never need tombstones
+inline bool slot_table_delete(t_slot_table* t, t_symbol* key) {
+    t_slot* slot = slot_table_find(t, key);
+    if(!slot) {
+        return false;
+    }
+
+    t->arena_garbage += slot->size;
+    t->count--;
+
+    size_t mask = t->capacity - 1;
+    size_t hole = slot - t->slots;
+    for(size_t i = (hole + 1) & mask; t->slots[i].key != nullptr; i = (i + 1) & mask) {
+        size_t home = _slot_table_hash(t, t->slots[i].key);
+        // move the entry into the hole if the hole lies between its home
+        // position and where it currently sits (cyclically)
+        if(((i - home) & mask) >= ((i - hole) & mask)) {
+            t->slots[hole] = t->slots[i];
+            hole = i;
+        }
+    }
+    t->slots[hole].key = nullptr;
+
+    return true;
+}
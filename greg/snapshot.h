@@ -0,0 +1,313 @@
+/*
+ *  snapshot.h
+ *  binary snapshots of greg's contents, for saving with the patcher or to
+ *  a file
+ *
+ * Copyright (C) 2023-2025 Manolo Müller
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License
+ * as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * layout (native byte order, no padding):
+ *
+ * header       magic "GREG", u32 version, u64 symbol count,
+ *              u64 string table size
+ * strings      all symbol names, zero terminated, each stored once
+ * register     u32 type, u32 elemtype, u64 size,
+ *              size tag bytes (only if elemtype is A_NOTHING),
+ *              size 8 byte values
+ * slots        u64 slot count, then per slot:
+ *              u64 key (string index), u64 size, size tag bytes,
+ *              size 8 byte values
+ *
+ * symbols are stored as their index into the string table. reading is a
+ * single pass over the buffer, the only per-symbol work is one gensym.
+ *
+ */
+
+#pragma once
+
+#include "ext.h"
+#include "msg_data.h"
+#include "slot_table.h"
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+inline constexpr char SNAPSHOT_MAGIC[4] = {'G', 'R', 'E', 'G'};
+inline constexpr uint32_t SNAPSHOT_VERSION = 1;
+
+struct t_snapshot_writer {
+    std::vector<char> body;
+    std::string strings;
+    std::unordered_map<t_symbol*, uint64_t> symbols;
+
+    template <typename T> void put(T value) {
+        const char* p = reinterpret_cast<const char*>(&value);
+        body.insert(body.end(), p, p + sizeof(T));
+    }
+
+    uint64_t intern(t_symbol* s) {
+        auto [it, inserted] = symbols.try_emplace(s, symbols.size());
+        if(inserted) {
+            strings.append(s->s_name);
+            strings.push_back('\0');
+        }
+        return it->second;
+    }
+
+    void put_value(short type, union word w) {
+        if(type == A_SYM) {
+            put<uint64_t>(intern(w.w_sym));
+        } else {
+            put(w);
+        }
+    }
+};
+
+inline std::vector<char> snapshot_write(const t_msg_data* data, const t_slot_table* slots) {
+    t_snapshot_writer w;
+
+    w.put<uint32_t>(data->type);
+    w.put<uint32_t>(data->elemtype);
+    w.put<uint64_t>(data->size);
+    if(data->elemtype == A_NOTHING) {
+        w.body.insert(w.body.end(), data->tags, data->tags + data->size);
+    }
+    for(size_t i=0; i<data->size; i++) {
+        w.put_value(msg_data_elemtype(data, i), data->values[i]);
+    }
+
+    w.put<uint64_t>(slots->count);
+    for(size_t i=0; i<slots->capacity; i++) {
+        const t_slot* slot = slots->slots + i;
+        if(slot->key == nullptr) {
+            continue;
+        }
+        const t_atom* atoms = slot_table_atoms(slots, slot);
+        w.put<uint64_t>(w.intern(slot->key));
+        w.put<uint64_t>(slot->size);
+        for(size_t j=0; j<slot->size; j++) {
+            w.body.push_back((char)atoms[j].a_type);
+        }
+        for(size_t j=0; j<slot->size; j++) {
+            w.put_value(atoms[j].a_type, atoms[j].a_w);
+        }
+    }
+
+    std::vector<char> result(SNAPSHOT_MAGIC, SNAPSHOT_MAGIC + 4);
+    auto append = [&result](auto value) {
+        const char* p = reinterpret_cast<const char*>(&value);
+        result.insert(result.end(), p, p + sizeof(value));
+    };
+    append(SNAPSHOT_VERSION);
+    append((uint64_t)w.symbols.size());
+    append((uint64_t)w.strings.size());
+    result.insert(result.end(), w.strings.begin(), w.strings.end());
+    result.insert(result.end(), w.body.begin(), w.body.end());
+    return result;
+}
+
+struct t_snapshot_reader {
+    const char* pos;
+    const char* end;
+    std::vector<t_symbol*> symbols;
+    bool ok = true;
+
+    template <typename T> T get() {
+        T value{};
+        if(end - pos < (ptrdiff_t)sizeof(T)) {
+            ok = false;
+            return value;
+        }
+        memcpy(&value, pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+
+    const char* take(size_t n) {
+        if((size_t)(end - pos) < n) {
+            ok = false;
+            return nullptr;
+        }
+        const char* p = pos;
+        pos += n;
+        return p;
+    }
+
+    union word get_value(short type) {
+        union word w = get<union word>();
+        if(type == A_SYM) {
+            if(w.w_long < 0 || (size_t)w.w_long >= symbols.size()) {
+                ok = false;
+                w.w_sym = gensym("");
+            } else {
+                w.w_sym = symbols[w.w_long];
+            }
+        }
+        return w;
+    }
+};
+
+// only plain values are stored, anything else in a file means it's damaged
+inline bool snapshot_valid_elemtype(long type) {
+    return type == A_LONG || type == A_FLOAT || type == A_SYM;
+}
+
+// the register's type has to fit its size and elements, as in msg_data.h
+inline bool snapshot_valid_type(e_max_atomtypes type, e_max_atomtypes elemtype, uint64_t size, const char* tags) {
+    if(type == A_NOTHING) {
+        return size == 0;
+    }
+    if(type == A_GIMME) {
+        return size > 0;
+    }
+    return snapshot_valid_elemtype(type) && size == 1 && (tags ? tags[0] : elemtype) == type;
+}
+
+// reads a snapshot into `data` and `slots`, which are expected to be empty.
+// returns false if the buffer isn't a valid snapshot.
+inline bool snapshot_read(const char* buf, size_t len, t_msg_data* data, t_slot_table* slots) {
+    t_snapshot_reader r{buf, buf + len};
+
+    const char* magic = r.take(4);
+    if(!magic || memcmp(magic, SNAPSHOT_MAGIC, 4) || r.get<uint32_t>() != SNAPSHOT_VERSION) {
+        return false;
+    }
+
+    uint64_t nsymbols = r.get<uint64_t>();
+    uint64_t strings_size = r.get<uint64_t>();
+    const char* strings = r.take(strings_size);
+    // every symbol takes at least its terminating zero
+    if(!r.ok || nsymbols > strings_size || (strings_size && strings[strings_size - 1] != '\0')) {
+        return false;
+    }
+    r.symbols.reserve(nsymbols);
+    for(const char* s = strings; s < strings + strings_size; s += strlen(s) + 1) {
+        r.symbols.push_back(gensym(s));
+    }
+    if(r.symbols.size() != nsymbols) {
+        return false;
+    }
+
+    e_max_atomtypes type = static_cast<e_max_atomtypes>(r.get<uint32_t>());
+    e_max_atomtypes elemtype = static_cast<e_max_atomtypes>(r.get<uint32_t>());
+    uint64_t size = r.get<uint64_t>();
+    const char* tags = elemtype == A_NOTHING ? r.take(size) : nullptr;
+    if(!r.ok || size > (uint64_t)(r.end - r.pos) / sizeof(union word)) {
+        return false;
+    }
+    if(elemtype != A_NOTHING && !snapshot_valid_elemtype(elemtype)) {
+        return false;
+    }
+    for(size_t i=0; tags && i<size; i++) {
+        if(!snapshot_valid_elemtype(tags[i])) {
+            return false;
+        }
+    }
+    if(!snapshot_valid_type(type, elemtype, size, tags)) {
+        return false;
+    }
+
+    msg_data_resize(data, size);
+    data->type = type;
+    data->elemtype = elemtype;
+    if(tags) {
+        _msg_data_alloc_tags(data);
+        memcpy(data->tags, tags, size);
+    }
+    for(size_t i=0; i<size; i++) {
+        data->values[i] = r.get_value(tags ? tags[i] : elemtype);
+    }
+
+    uint64_t nslots = r.get<uint64_t>();
+    std::vector<t_atom> atoms;
+    for(uint64_t i=0; i<nslots && r.ok; i++) {
+        uint64_t key = r.get<uint64_t>();
+        uint64_t n = r.get<uint64_t>();
+        const char* slot_tags = r.take(n);
+        // store always keeps at least one atom
+        if(!r.ok || key >= r.symbols.size() || n == 0 || n > (uint64_t)(r.end - r.pos) / sizeof(union word)) {
+            return false;
+        }
+        for(size_t j=0; j<n; j++) {
+            if(!snapshot_valid_elemtype(slot_tags[j])) {
+                return false;
+            }
+        }
+        atoms.resize(n);
+        for(size_t j=0; j<n; j++) {
+            atoms[j].a_type = slot_tags[j];
+            atoms[j].a_w = r.get_value(slot_tags[j]);
+        }
+        slot_table_store(slots, r.symbols[key], n, atoms.data());
+    }
+
+    return r.ok;
+}
+
+// patcher dictionaries only hold text, so snapshots embedded in the patcher
+// are base64 encoded
+
+inline constexpr char SNAPSHOT_BASE64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+inline std::string snapshot_encode_base64(const std::vector<char>& in) {
+    std::string out;
+    out.reserve((in.size() + 2) / 3 * 4);
+    size_t i = 0;
+    for(; i + 2 < in.size(); i += 3) {
+        uint32_t v = (uint8_t)in[i] << 16 | (uint8_t)in[i+1] << 8 | (uint8_t)in[i+2];
+        out.push_back(SNAPSHOT_BASE64[v >> 18 & 63]);
+        out.push_back(SNAPSHOT_BASE64[v >> 12 & 63]);
+        out.push_back(SNAPSHOT_BASE64[v >> 6 & 63]);
+        out.push_back(SNAPSHOT_BASE64[v & 63]);
+    }
+    if(i < in.size()) {
+        uint32_t v = (uint8_t)in[i] << 16 | (i + 1 < in.size() ? (uint8_t)in[i+1] << 8 : 0);
+        out.push_back(SNAPSHOT_BASE64[v >> 18 & 63]);
+        out.push_back(SNAPSHOT_BASE64[v >> 12 & 63]);
+        out.push_back(i + 1 < in.size() ? SNAPSHOT_BASE64[v >> 6 & 63] : '=');
+        out.push_back('=');
+    }
+    return out;
+}
+
+inline std::vector<char> snapshot_decode_base64(const char* in) {
+    int8_t lookup[256];
+    memset(lookup, -1, sizeof(lookup));
+    for(int i=0; i<64; i++) {
+        lookup[(uint8_t)SNAPSHOT_BASE64[i]] = i;
+    }
+
+    std::vector<char> out;
+    out.reserve(strlen(in) / 4 * 3);
+    uint32_t v = 0;
+    int bits = 0;
+    for(const char* c = in; *c && *c != '='; c++) {
+        int8_t d = lookup[(uint8_t)*c];
+        if(d < 0) {
+            continue;
+        }
+        v = v << 6 | d;
+        bits += 6;
+        if(bits >= 8) {
+            bits -= 8;
+            out.push_back((char)(v >> bits & 0xff));
+        }
+    }
+    return out;
+}
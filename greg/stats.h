@@ -0,0 +1,102 @@
+/*
+ *  stats.h
+ *  memory and throughput counters, per object and for all objects
+ *
+ * Copyright (C) 2023-2025 Manolo Müller
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License
+ * as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include "ext.h"
+#include <atomic>
+#include <cstdint>
+
+// counters for a single object, only ever touched by that object
+typedef struct _mem_stats {
+    int64_t bytes;
+    int64_t peak_bytes;
+    int64_t allocs;
+    int64_t frees;
+} t_mem_stats;
+
+// sums over all objects, which may live on different threads
+struct t_mem_totals {
+    std::atomic<int64_t> bytes{0};
+    std::atomic<int64_t> peak_bytes{0};
+    std::atomic<int64_t> allocs{0};
+    std::atomic<int64_t> frees{0};
+    std::atomic<int64_t> scratch_bytes{0};  // shared output buffers, see msg_data.h
+};
+
+inline t_mem_totals mem_totals;
+
+inline void mem_stats_init(t_mem_stats* s) {
+    s->bytes = 0;
+    s->peak_bytes = 0;
+    s->allocs = 0;
+    s->frees = 0;
+}
+
+// memory that belongs to no single object only shows up in the totals
+inline void mem_totals_alloc(size_t bytes) {
+    int64_t total = mem_totals.bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    int64_t peak = mem_totals.peak_bytes.load(std::memory_order_relaxed);
+    while(total > peak && !mem_totals.peak_bytes.compare_exchange_weak(peak, total, std::memory_order_relaxed)) {}
+    mem_totals.allocs.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void mem_totals_free(size_t bytes) {
+    mem_totals.bytes.fetch_sub(bytes, std::memory_order_relaxed);
+    mem_totals.frees.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void mem_stats_alloc(t_mem_stats* s, size_t bytes) {
+    if(!s) {
+        return;
+    }
+    s->bytes += bytes;
+    s->peak_bytes = MAX(s->peak_bytes, s->bytes);
+    s->allocs++;
+    mem_totals_alloc(bytes);
+}
+
+inline void mem_stats_free(t_mem_stats* s, size_t bytes) {
+    if(!s) {
+        return;
+    }
+    s->bytes -= bytes;
+    s->frees++;
+    mem_totals_free(bytes);
+}
+
+// allocation wrappers for everything that wants to be counted
+
+inline void* stats_newptr(t_mem_stats* s, size_t bytes) {
+    mem_stats_alloc(s, bytes);
+    return sysmem_newptr(bytes);
+}
+
+inline void* stats_newptrclear(t_mem_stats* s, size_t bytes) {
+    mem_stats_alloc(s, bytes);
+    return sysmem_newptrclear(bytes);
+}
+
+inline void stats_freeptr(t_mem_stats* s, void* ptr, size_t bytes) {
+    if(ptr) {
+        mem_stats_free(s, bytes);
+        sysmem_freeptr(ptr);
+    }
+}
@@ -0,0 +1,158 @@
+/*
+ * msg_data_test.cpp - checks and times the variadic msg_data_set
+ * Copyright (C) 2025 Manolo Müller
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License
+ * as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * every pack is stored with msg_data_set(x, values...) and with the old
+ * setters (msg_data_set_long/float/symbol, or atoms and msg_data_set_list),
+ * and both are checked against the expected type, element type, tags and
+ * values. the checks run one after another on the same t_msg_data, so
+ * going from mixed to homogeneous and back is covered too. then both ways
+ * of setting are timed.
+ */
+
+#include "msg_data.h"
+#include <chrono>
+
+static int s_failed = 0;
+
+static void fail(const char* name, const char* what, size_t i) {
+    printf("%s: %s differs at %zu\n", name, what, i);
+    s_failed = 1;
+}
+
+// compares `x` to the atoms it is expected to hold
+static void check(const char* name, const t_msg_data* x, e_max_atomtypes type, size_t argc, const t_atom* argv) {
+    if(x->size != argc) {
+        fail(name, "size", argc);
+        return;
+    }
+    if(x->type != type) {
+        fail(name, "type", 0);
+    }
+
+    bool homogeneous = true;
+    for(size_t i=1; i<argc; i++) {
+        homogeneous &= argv[i].a_type == argv[0].a_type;
+    }
+    if(x->elemtype != (homogeneous ? argv[0].a_type : A_NOTHING)) {
+        fail(name, "elemtype", 0);
+    }
+
+    for(size_t i=0; i<argc; i++) {
+        if(!homogeneous && x->tags[i] != argv[i].a_type) {
+            fail(name, "tag", i);
+        }
+        t_atom a;
+        msg_data_get_atom(x, i, &a);
+        if(a.a_type != argv[i].a_type || memcmp(&a.a_w, &argv[i].a_w, sizeof(union word))) {
+            fail(name, "value", i);
+        }
+    }
+}
+
+// the old way: a scalar setter for a single value, atoms and a list
+// otherwise
+static void set_old(t_msg_data* x, size_t argc, t_atom* argv) {
+    if(argc > 1) {
+        msg_data_set_list(x, argc, argv);
+    } else if(argv[0].a_type == A_LONG) {
+        msg_data_set_long(x, argv[0].a_w.w_long);
+    } else if(argv[0].a_type == A_FLOAT) {
+        msg_data_set_float(x, argv[0].a_w.w_float);
+    } else {
+        msg_data_set_symbol(x, argv[0].a_w.w_sym);
+    }
+}
+
+template <AtomValue ... V>
+static void test(const char* name, t_msg_data* x, V ... values) {
+    t_atom argv[sizeof...(V)];
+    t_atom* a = argv;
+    (atom_set(a++, values), ...);
+
+    msg_data_set(x, values...);
+    check(name, x, AtomPack<V...>::type, sizeof...(V), argv);
+
+    set_old(x, sizeof...(V), argv);
+    check(name, x, AtomPack<V...>::type, sizeof...(V), argv);
+}
+
+// nanoseconds per set, the data is read back so the setting can't be
+// optimized away
+template <typename F>
+static double measure(t_msg_data* x, F set) {
+    constexpr long iterations = 2000000;
+    uint64_t sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(long i=0; i<iterations; i++) {
+        set(i);
+        sum += (uint64_t)x->values[0].w_long + x->size;
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    if(sum == 42) {
+        printf("\n");
+    }
+    return elapsed.count() / iterations;
+}
+
+static void bench(const char* name, double before, double after) {
+    printf("%-24s old %6.2f ns, msg_data_set %6.2f ns (%.1fx)\n", name, before, after, before / after);
+}
+
+int main() {
+    t_msg_data x;
+    msg_data_init(&x);
+    t_symbol* foo = gensym("foo");
+    t_symbol* bar = gensym("bar");
+
+    test("int", &x, 7);
+    test("bool", &x, true);
+    test("float", &x, 2.5);
+    test("symbol", &x, foo);
+    test("ints", &x, 1, 2L, (short)3);
+    test("int float symbol", &x, 1, 2.5, foo);
+    test("floats", &x, 0.5f, 1.5);
+    test("symbol int", &x, bar, -4);
+    test("symbols", &x, foo, bar, foo, bar);
+    test("float symbol int float", &x, 1.25, foo, 9L, -0.5f);
+    test("int again", &x, 0);
+
+    t_atom atoms[3];
+    bench("int", measure(&x, [&](long i) { msg_data_set_long(&x, i); }),
+                 measure(&x, [&](long i) { msg_data_set(&x, i); }));
+    bench("float", measure(&x, [&](long i) { msg_data_set_float(&x, (double)i); }),
+                   measure(&x, [&](long i) { msg_data_set(&x, (double)i); }));
+    bench("symbol", measure(&x, [&](long i) { msg_data_set_symbol(&x, i & 1 ? foo : bar); }),
+                    measure(&x, [&](long i) { msg_data_set(&x, i & 1 ? foo : bar); }));
+    bench("ints", measure(&x, [&](long i) {
+                      atom_setlong(atoms, i);
+                      atom_setlong(atoms + 1, i + 1);
+                      atom_setlong(atoms + 2, i + 2);
+                      msg_data_set_list(&x, 3, atoms);
+                  }),
+                  measure(&x, [&](long i) { msg_data_set(&x, i, i + 1, i + 2); }));
+    bench("int float symbol", measure(&x, [&](long i) {
+                                  atom_setlong(atoms, i);
+                                  atom_setfloat(atoms + 1, 0.5);
+                                  atom_setsym(atoms + 2, foo);
+                                  msg_data_set_list(&x, 3, atoms);
+                              }),
+                              measure(&x, [&](long i) { msg_data_set(&x, i, 0.5, foo); }));
+
+    msg_data_free(&x);
+    return s_failed;
+}
@@ -0,0 +1,131 @@
+/*
+ * ext.h - the parts of the max api that msg_data.h uses, so its tests can
+ * be built without the max sdk. not used by the external itself.
+ */
+
+#pragma once
+
+#include <cassert>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+#define MAX_ERR_NONE 0
+#define MAX_ERR_GENERIC -1
+
+typedef long t_atom_long;
+typedef double t_atom_float;
+typedef long t_max_err;
+
+typedef struct _symbol { const char* s_name; void* s_thing; } t_symbol;
+typedef struct _object { void* o_messlist; } t_object;
+typedef void t_outlet;
+
+union word {
+    t_atom_long w_long;
+    t_atom_float w_float;
+    t_symbol* w_sym;
+    t_object* w_obj;
+};
+
+typedef struct atom { short a_type; union word a_w; } t_atom;
+
+typedef enum {
+    A_NOTHING = 0, A_LONG, A_FLOAT, A_SYM, A_OBJ, A_DEFLONG, A_DEFFLOAT, A_DEFSYM, A_GIMME, A_CANT
+} e_max_atomtypes;
+
+// symbols are interned like in max, so they can be compared by pointer
+inline t_symbol* gensym(const char* s) {
+    static std::unordered_map<std::string, std::unique_ptr<t_symbol>> table;
+    auto [it, inserted] = table.try_emplace(s);
+    if(inserted) {
+        it->second = std::make_unique<t_symbol>(t_symbol{it->first.c_str(), nullptr});
+    }
+    return it->second.get();
+}
+
+inline void post(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+    printf("\n");
+}
+
+inline void* sysmem_newptr(long size) {
+    return malloc(size);
+}
+
+inline void* sysmem_newptrclear(long size) {
+    return calloc(1, size);
+}
+
+inline void sysmem_freeptr(void* p) {
+    free(p);
+}
+
+inline void sysmem_copyptr(const void* src, void* dst, long bytes) {
+    memmove(dst, src, bytes);
+}
+
+inline t_max_err atom_setlong(t_atom* a, t_atom_long value) {
+    a->a_type = A_LONG;
+    a->a_w.w_long = value;
+    return MAX_ERR_NONE;
+}
+
+inline t_max_err atom_setfloat(t_atom* a, double value) {
+    a->a_type = A_FLOAT;
+    a->a_w.w_float = value;
+    return MAX_ERR_NONE;
+}
+
+inline t_max_err atom_setsym(t_atom* a, t_symbol* value) {
+    a->a_type = A_SYM;
+    a->a_w.w_sym = value;
+    return MAX_ERR_NONE;
+}
+
+inline long atom_gettype(const t_atom* a) {
+    return a->a_type;
+}
+
+inline t_atom_long atom_getlong(const t_atom* a) {
+    return a->a_type == A_FLOAT ? (t_atom_long)a->a_w.w_float : a->a_type == A_LONG ? a->a_w.w_long : 0;
+}
+
+inline t_atom_float atom_getfloat(const t_atom* a) {
+    return a->a_type == A_LONG ? (t_atom_float)a->a_w.w_long : a->a_type == A_FLOAT ? a->a_w.w_float : 0;
+}
+
+inline t_symbol* atom_getsym(const t_atom* a) {
+    return a->a_type == A_SYM ? a->a_w.w_sym : gensym("");
+}
+
+inline t_max_err atom_setatom_array(long ac, t_atom* av, long count, t_atom* vals) {
+    memmove(av, vals, MIN(ac, count) * sizeof(t_atom));
+    return MAX_ERR_NONE;
+}
+
+// parsing isn't needed by the tests
+inline t_max_err atom_setparse(long* ac, t_atom** av, const char* parsestr) {
+    return MAX_ERR_GENERIC;
+}
+
+// outlets are never called by the tests
+inline void* outlet_int(t_outlet* o, t_atom_long n) { return nullptr; }
+inline void* outlet_float(t_outlet* o, double f) { return nullptr; }
+inline void* outlet_list(t_outlet* o, t_symbol* s, short ac, t_atom* av) { return nullptr; }
+inline void* outlet_anything(t_outlet* o, t_symbol* s, short ac, t_atom* av) { return nullptr; }
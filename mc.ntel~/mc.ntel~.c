@@ -0,0 +1,262 @@
+/*
+ *  mc.ntel~.c
+ *  ntel~ for multichannel phasors
+ *
+ * Copyright (C) 2023-2025 Manolo Müller
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License
+ * as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ext.h"
+#include "z_dsp.h"
+#include "ext_obex.h"
+#include <stdatomic.h>
+#include "ntel_scan.h"
+
+// steps of all channels go through one single producer, single consumer
+// ring buffer. must be a power of two.
+#define MCNTEL_QUEUE_SIZE 4096
+
+typedef struct _mcntel_event {
+    long channel;
+    long step;
+    long offset;    // sample within the block the edge was detected in
+} t_mcntel_event;
+
+typedef struct _mcntel {
+    t_pxobject w_obj;
+    long divider;
+    t_bool* active;     // per step: does the step get output
+    long* steps;
+    long n_steps;
+    // per channel state, indexed by channel
+    long* current_step;
+    t_sample* history;
+    void* clock;
+    void* outlet;
+    t_mcntel_event* queue;
+    _Atomic long queue_head;    // only written by the perform routine
+    _Atomic long queue_tail;    // only written by tick
+    _Atomic long overflows;
+    // scratch space, reused for every channel
+    t_sample* scaled;
+    long* events;
+    long block_size;
+} t_mcntel;
+
+
+void* mcntel_new(t_symbol* s, long argc, t_atom* argv);
+void mcntel_free(t_mcntel* x);
+void mcntel_perform64(t_mcntel* x, t_object* dsp64, double** ins, long numins, double** outs, long numouts, long sampleframes, long flags, void* userparam);
+void mcntel_dsp64(t_mcntel* x, t_object* dsp64, short* count, double samplerate, long maxvectorsize, long flags);
+void mcntel_tick(t_mcntel* x);
+void mcntel_overflows(t_mcntel* x);
+void mcntel_usage(t_mcntel* x);
+void mcntel_assist(t_mcntel* x, void* b, long m, long a, char* s);
+
+static t_class* s_mcntel_class;
+
+void ext_main(void* r) {
+    t_class* c = class_new("mc.ntel~", (method)mcntel_new, (method)mcntel_free, sizeof(t_mcntel), NULL, A_GIMME, 0);
+    class_addmethod(c, (method)mcntel_dsp64,     "dsp64",     A_CANT, 0);
+    class_addmethod(c, (method)mcntel_usage,     "usage",             0);
+    class_addmethod(c, (method)mcntel_overflows, "overflows",         0);
+    class_addmethod(c, (method)mcntel_assist,    "assist",    A_CANT, 0);
+    class_dspinit(c);
+    class_register(CLASS_BOX, c);
+    s_mcntel_class = c;
+}
+
+void* mcntel_new(t_symbol* s, long argc, t_atom* argv) {
+    t_mcntel* x = (t_mcntel*)object_alloc(s_mcntel_class);
+
+    dsp_setup((t_pxobject*)x, 1); // one inlet for the multichannel phasor
+    x->w_obj.z_misc |= Z_MC_INLETS;
+
+    if(!argc) {
+        object_post((t_object*)x, "no divider given, defaulting to 1");
+        x->divider = 1;
+    } else {
+        x->divider = atom_getlong(argv);
+        if(x->divider < 1) {
+            object_post((t_object*)x, "divider must be at least 1, defaulting to 1");
+            x->divider = 1;
+        }
+    }
+
+    // without steps, all steps are output
+    x->n_steps = argc > 1 ? argc - 1 : x->divider;
+    x->steps = (long*)sysmem_newptr(x->n_steps * sizeof(long));
+    x->active = (t_bool*)sysmem_newptrclear(x->divider * sizeof(t_bool));
+    for(long i=0; i<x->n_steps; i++) {
+        long step = i;
+        if(argc > 1) {
+            step = atom_getlong(argv + 1 + i);
+            long highest_step = x->divider - 1;
+            if(step < 0 || step > highest_step) {
+                object_post((t_object*)x, "step nr %ld with value %ld clamped to range 0 - %ld", i+1, step, highest_step);
+                step = CLAMP(step, 0, highest_step);
+            }
+        }
+        x->steps[i] = step;
+        x->active[step] = true;
+    }
+
+    x->outlet = listout(x);
+
+    // allocated for the maximum, so the channel count can change without
+    // touching the state on the audio thread
+    x->current_step = (long*)sysmem_newptrclear(MC_MAX_CHANS * sizeof(long));
+    x->history = (t_sample*)sysmem_newptrclear(MC_MAX_CHANS * sizeof(t_sample));
+
+    x->clock = clock_new(x, (method)mcntel_tick);
+    x->queue = (t_mcntel_event*)sysmem_newptr(MCNTEL_QUEUE_SIZE * sizeof(t_mcntel_event));
+    atomic_init(&x->queue_head, 0);
+    atomic_init(&x->queue_tail, 0);
+    atomic_init(&x->overflows, 0);
+
+    x->scaled = NULL;
+    x->events = NULL;
+    x->block_size = 0;
+
+    return x;
+}
+
+void mcntel_free(t_mcntel* x) {
+    dsp_free((t_pxobject*)x);
+    freeobject(x->clock);
+    sysmem_freeptr(x->steps);
+    sysmem_freeptr(x->active);
+    sysmem_freeptr(x->current_step);
+    sysmem_freeptr(x->history);
+    sysmem_freeptr(x->queue);
+    sysmem_freeptr(x->scaled);
+    sysmem_freeptr(x->events);
+}
+
+// called from the perform routine only. never blocks or allocates, if the
+// queue is full the step is dropped and counted
+static inline t_bool mcntel_queue_push(t_mcntel* x, long channel, long step, long offset) {
+    long head = atomic_load_explicit(&x->queue_head, memory_order_relaxed);
+    long tail = atomic_load_explicit(&x->queue_tail, memory_order_acquire);
+    if(head - tail >= MCNTEL_QUEUE_SIZE) {
+        atomic_fetch_add_explicit(&x->overflows, 1, memory_order_relaxed);
+        return false;
+    }
+
+    t_mcntel_event* event = x->queue + (head & (MCNTEL_QUEUE_SIZE - 1));
+    event->channel = channel;
+    event->step = step;
+    event->offset = offset;
+    atomic_store_explicit(&x->queue_head, head + 1, memory_order_release);
+    return true;
+}
+
+// the same passes as in ntel~, once per channel. the channel's state is
+// loaded into locals and written back once at the end
+void mcntel_perform64(t_mcntel* x, t_object* dsp64, double** ins, long numins, double** outs, long numouts, long sampleframes, long flags, void* userparam) {
+    t_sample* scaled = x->scaled;
+    long* events = x->events;
+    t_sample divider = x->divider;
+    long n = MIN(sampleframes, x->block_size);
+    long numchans = MIN(numins, MC_MAX_CHANS);
+    t_bool pushed = false;
+
+    if(!n) {
+        return;
+    }
+
+    for(long c=0; c<numchans; c++) {
+        t_sample* in = ins[c];
+        t_sample history = x->history[c];
+        long current_step = x->current_step[c];
+
+        // the same passes as ntel~, only the samples where the scaled phase
+        // didn't rise are looked at
+        ntel_scale(in, scaled, divider, n);
+        long n_events = ntel_scan(scaled, history, events, n);
+
+        for(long e=0; e<n_events; e++) {
+            long i = events[e];
+            t_sample delta = scaled[i] - (i ? scaled[i - 1] : history);
+            if(delta < 0) {
+                if(x->active[current_step]) {
+                    pushed |= mcntel_queue_push(x, c, current_step, i);
+                }
+                current_step = (current_step + 1) % x->divider;
+            } else {
+                // stalled phasor, reset this channel's step sequence
+                current_step = 0;
+            }
+        }
+
+        x->history[c] = scaled[n - 1];
+        x->current_step[c] = current_step;
+    }
+
+    if(pushed) {
+        clock_delay(x->clock, 0);
+    }
+}
+
+void mcntel_dsp64(t_mcntel* x, t_object* dsp64, short* count, double samplerate, long maxvectorsize, long flags) {
+    if(maxvectorsize > x->block_size) {
+        sysmem_freeptr(x->scaled);
+        sysmem_freeptr(x->events);
+        x->scaled = (t_sample*)sysmem_newptr(maxvectorsize * sizeof(t_sample));
+        x->events = (long*)sysmem_newptr(maxvectorsize * sizeof(long));
+        x->block_size = maxvectorsize;
+    }
+
+    object_method(dsp64, gensym("dsp_add64"), x, mcntel_perform64, 0, NULL);
+}
+
+// drains all queued steps in the order they were detected, channel by
+// channel within a block
+void mcntel_tick(t_mcntel* x) {
+    long tail = atomic_load_explicit(&x->queue_tail, memory_order_relaxed);
+    long head = atomic_load_explicit(&x->queue_head, memory_order_acquire);
+
+    t_atom out[2];
+    for(; tail != head; tail++) {
+        t_mcntel_event event = x->queue[tail & (MCNTEL_QUEUE_SIZE - 1)];
+        atomic_store_explicit(&x->queue_tail, tail + 1, memory_order_release);
+
+        // channels are counted from 1, like everywhere else in mc
+        atom_setlong(out, event.channel + 1);
+        atom_setlong(out + 1, event.step);
+        outlet_list(x->outlet, NULL, 2, out);
+    }
+}
+
+void mcntel_overflows(t_mcntel* x) {
+    object_post((t_object*)x, "%ld steps dropped because the event queue was full", atomic_load(&x->overflows));
+}
+
+void mcntel_usage(t_mcntel* x) {
+    object_post((t_object*)x, "mc.ntel~ usage:");
+    object_post((t_object*)x, "arg 1: (int) into how many steps to divide each channel's phasor (at least 1)");
+    object_post((t_object*)x, "args 2...n: (list) which steps to output (count starts at 0)");
+    object_post((t_object*)x, "if args 2...n is empty, all steps 0 .. (value of arg 1) - 1 are output");
+    object_post((t_object*)x, "output: (list) channel step, channels start at 1");
+    object_post((t_object*)x, "message overflows: post how many steps were dropped because the scheduler fell behind");
+}
+
+void mcntel_assist(t_mcntel* x, void* b, long m, long a, char* s) {
+    if (m == ASSIST_INLET) {
+        snprintf_zero(s, 256, "(multichannel signal) Phasor inputs (0 - 1)");
+    } else if(m == ASSIST_OUTLET) {
+        snprintf_zero(s, 256, "(list) Channel and step");
+    }
+}
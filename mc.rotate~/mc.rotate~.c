@@ -45,15 +45,39 @@
 #include "ext.h"
 #include "ext_obex.h"
 #include "z_dsp.h"
+#include "mcroute.h"
+#include <math.h>
 
 typedef struct _mcrotate {
     t_pxobject m_obj;
     long numchans;
     int rot;
+    double fade;        // crossfade time in ms, 0 switches at once
+    long playing;       // the rotation the audio thread plays
+    // audio thread only: the rotation that is played and the one that is
+    // faded out
+    t_mcroute_matrix current;
+    t_mcroute_matrix previous;
+    long fade_length;   // in samples
+    long fade_pos;      // fade_length when no fade is running
+    double* gain_from;  // per-sample fade or pan gains, shared by all channels
+    double* gain_to;
+    long* base;         // per-sample whole rotation of the rotation signal
+    long block_size;
+    short rotation_connected;
+    long rotation_chans;    // channels of the middle and right inlet, the
+    long trigger_chans;     // first one of each is used
+    // with a trigger signal, rotations are built by the int method and
+    // switched to at the trigger sample
+    t_mcroute_queue queue;
+    short trigger_connected;
+    double trigger_last;
+    t_critical lock;    // int may come from several threads
+    double samplerate;
 } t_mcrotate;
 
 
-void* mcrotate_new(void);
+void* mcrotate_new(t_symbol* s, long argc, t_atom* argv);
 void mcrotate_free(t_mcrotate* x);
 void mcrotate_int(t_mcrotate* x, long a);
 long mcrotate_multichanneloutputs(t_mcrotate* x, long index);
@@ -65,7 +89,7 @@ void mcrotate_assist(t_mcrotate* x, void* b, long m, long a, char* s);
 static t_class* s_mcrotate_class;
 
 void ext_main(void* r) {
-    t_class* c = class_new("mc.rotate~", (method)mcrotate_new, (method)mcrotate_free, sizeof(t_mcrotate), 0L, 0);
+    t_class* c = class_new("mc.rotate~", (method)mcrotate_new, (method)mcrotate_free, sizeof(t_mcrotate), 0L, A_GIMME, 0);
 
     class_addmethod(c, (method)mcrotate_int,                 "int",                 A_LONG, 0);
     class_addmethod(c, (method)mcrotate_multichanneloutputs, "multichanneloutputs", A_CANT, 0);
@@ -73,32 +97,86 @@ void ext_main(void* r) {
     class_addmethod(c, (method)mcrotate_dsp64,               "dsp64",                A_CANT, 0);
     class_addmethod(c, (method)mcrotate_assist,              "assist",                A_CANT, 0);
 
+    CLASS_ATTR_DOUBLE(c, "fade", 0, t_mcrotate, fade);
+    CLASS_ATTR_LABEL(c, "fade", 0, "Crossfade Time (ms)");
+    CLASS_ATTR_FILTER_MIN(c, "fade", 0);
+
     class_dspinit(c);
 
     s_mcrotate_class = c;
     class_register(CLASS_BOX, s_mcrotate_class);
 }
 
-void* mcrotate_new(void) {
+void* mcrotate_new(t_symbol* s, long argc, t_atom* argv) {
     t_mcrotate* x = (t_mcrotate*)object_alloc(s_mcrotate_class);
 
-    dsp_setup((t_pxobject*)x, 1);
+    // the middle inlet is the rotation signal, the right one the trigger
+    dsp_setup((t_pxobject*)x, 3);
     x->m_obj.z_misc |= Z_NO_INPLACE | Z_MC_INLETS;
     outlet_new((t_object*)x, "multichannelsignal");
 
     x->numchans = 1;
     x->rot = 0;
+    x->fade = 0;
+    x->playing = 0;
+    mcroute_matrix_init(&x->current, MC_MAX_CHANS);
+    mcroute_matrix_init(&x->previous, MC_MAX_CHANS);
+    x->fade_length = 0;
+    x->fade_pos = 0;
+    x->gain_from = NULL;
+    x->gain_to = NULL;
+    x->base = NULL;
+    x->block_size = 0;
+    x->rotation_connected = 0;
+    x->rotation_chans = 1;
+    x->trigger_chans = 1;
+    mcroute_queue_init(&x->queue, MC_MAX_CHANS);
+    x->trigger_connected = 0;
+    x->trigger_last = 0;
+    critical_new(&x->lock);
+    x->samplerate = 44100;
+
+    attr_args_process(x, (short)argc, argv);
 
     return x;
 }
 
 void mcrotate_free(t_mcrotate* x) {
     dsp_free((t_pxobject*)x);
+    sysmem_freeptr(x->gain_from);
+    sysmem_freeptr(x->gain_to);
+    sysmem_freeptr(x->base);
+    mcroute_matrix_free(&x->current);
+    mcroute_matrix_free(&x->previous);
+    mcroute_queue_free(&x->queue);
+    critical_free(x->lock);
+}
+
+// output j plays input j - rot
+static void mcrotate_build(t_mcroute_matrix* m, long rot, long numchans) {
+    mcroute_matrix_begin(m, numchans);
+    for(long j=0; j<numchans; j++) {
+        mcroute_matrix_add(m, (int)(((j - rot) % numchans + numchans) % numchans), 1);
+        mcroute_matrix_end_row(m);
+    }
 }
 
 void mcrotate_int(t_mcrotate* x, long a) {
     a = labs(a);
     x->rot = a % x->numchans;
+
+    if(x->trigger_connected) {
+        // played from the next trigger on
+        critical_enter(x->lock);
+        t_mcroute_matrix* m = mcroute_queue_back(&x->queue);
+        if(m) {
+            mcrotate_build(m, x->rot, x->numchans);
+            mcroute_queue_push(&x->queue);
+        } else {
+            object_error((t_object*)x, "%d rotations are waiting for a trigger already", MCROUTE_QUEUE_DEPTH);
+        }
+        critical_exit(x->lock);
+    }
 }
 
 long mcrotate_multichanneloutputs(t_mcrotate* x, long index) {
@@ -106,30 +184,171 @@ long mcrotate_multichanneloutputs(t_mcrotate* x, long index) {
 }
 
 long mcrotate_inputchanged(t_mcrotate* x, long index, long count) {
-    if(count != x->numchans) {
+    // the signals of the other inlets are found after the left inlet's
+    // channels, so their channels are counted too
+    if(index == 1) {
+        x->rotation_chans = CLAMP(count, 1, MC_MAX_CHANS);
+    } else if(index == 2) {
+        x->trigger_chans = CLAMP(count, 1, MC_MAX_CHANS);
+    }
+
+    // only the left inlet decides the number of channels
+    if(index == 0 && count != x->numchans) {
         x->numchans = CLAMP(count, 1, MC_MAX_CHANS);
+        // waiting rotations were built for the old channels
+        critical_enter(x->lock);
+        mcroute_queue_invalidate(&x->queue, sys_getdspobjdspstate((t_object*)x));
+        critical_exit(x->lock);
         return true;
     }
     return false;
 }
 
+// equal power gains for the next `n` samples of the running fade, computed
+// once per block for all channels
+static void mcrotate_fade_gains(t_mcrotate* x, long n) {
+    double scale = (M_PI / 2) / x->fade_length;
+    for(long k=0; k<n; k++) {
+        double angle = MIN(x->fade_pos + k + 1, x->fade_length) * scale;
+        x->gain_from[k] = cos(angle);
+        x->gain_to[k] = sin(angle);
+    }
+}
+
+// rotation by a signal: output j plays input j - r. with a fractional r, it
+// pans with equal power between the two inputs next to j - r. the fraction is
+// the same for all outputs, so the gains are computed once per sample, and
+// the block is split where the whole rotation changes. each piece mixes the
+// two inputs of every output directly, they are found by counting up from
+// the whole rotation instead of building a matrix
+static void mcrotate_perform_signal(t_mcrotate* x, double** ins, double** outs, long numouts, long numchans, double* rotation, long n) {
+    long* base = x->base;
+    for(long k=0; k<n; k++) {
+        double r = isfinite(rotation[k]) ? rotation[k] : 0;
+        double whole = floor(r);
+        double frac = r - whole;
+        long b = (long)fmod(whole, (double)numchans);
+        base[k] = b < 0 ? b + numchans : b;
+        x->gain_from[k] = cos(frac * (M_PI / 2));
+        x->gain_to[k] = sin(frac * (M_PI / 2));
+    }
+
+    long start = 0;
+    while(start < n) {
+        long b = base[start];
+        long end = start + 1;
+        while(end < n && base[end] == b) {
+            end++;
+        }
+        // output 0 plays input -b and pans towards -b - 1
+        long from = b ? numchans - b : 0;
+        long to = (from ? from : numchans) - 1;
+        for(long j=0; j<numchans; j++) {
+            if(from == to) {
+                sysmem_copyptr(ins[from] + start, outs[j] + start, (end - start) * sizeof(double));
+            } else {
+                mcroute_mix(outs[j] + start, ins[from] + start, ins[to] + start, x->gain_from + start, x->gain_to + start, end - start);
+            }
+            to = from;
+            if(++from == numchans) {
+                from = 0;
+            }
+        }
+        start = end;
+    }
+
+    for(long j=numchans; j<numouts; j++) {
+        set_zero64(outs[j], n);
+    }
+}
+
 void mcrotate_perform64(t_mcrotate* x, t_object* dsp64, double** ins, long numins, double** outs, long numouts, long sampleframes, long flags, void* userparam) {
-    long numchans = MIN(numins, numouts);
-    for(long i=0; i<numchans; i++) {
-        int chan_idx = (i + x->rot) % x->numchans;
-        double* in = ins[i];
-        double* out = outs[chan_idx];
-        sysmem_copyptr(in, out, sampleframes * sizeof(double));
+    // the rotation and trigger signals come after the channels of the left inlet
+    long left = numins - x->rotation_chans - x->trigger_chans;
+    long inchans = MIN(x->numchans, left);
+    long numchans = MIN(inchans, numouts);
+    if(numchans < 1) {
+        return;
+    }
+    double* rotation = ins[left];
+    double* trigger = ins[left + x->rotation_chans];
+
+    if(x->current.numouts != numchans) {
+        // first block or a new channel count, nothing to fade from
+        mcrotate_build(&x->current, x->playing, numchans);
+        x->fade_pos = x->fade_length;
+    }
+
+    if(x->rotation_connected && sampleframes <= x->block_size) {
+        mcrotate_perform_signal(x, ins, outs, numouts, numchans, rotation, sampleframes);
+        if(x->trigger_connected) {
+            // triggered rotations are still taken, and played once the
+            // rotation signal is gone
+            t_mcroute_matrix* m = &x->current;
+            if(mcroute_follow_triggered(&x->queue, &x->current, &m, &x->trigger_last, trigger, sampleframes)) {
+                x->playing = (numchans - x->current.inputs[0]) % numchans;
+            }
+        }
+        return;
+    }
+
+    if(x->trigger_connected) {
+        // switches at the trigger sample, without a fade
+        t_mcroute_matrix* m = &x->current;
+        if(mcroute_process_triggered(&x->queue, &x->current, &m, &x->trigger_last, trigger, ins, inchans, outs, numouts, 0, sampleframes)) {
+            // output 0 plays input -rot
+            x->playing = (numchans - x->current.inputs[0]) % numchans;
+        }
+        return;
     }
+
+    // a new rotation is only taken once the running fade is done
+    if(x->fade_pos >= x->fade_length && x->rot != x->playing) {
+        t_mcroute_matrix previous = x->previous;
+        x->previous = x->current;
+        x->current = previous;
+        x->playing = x->rot;
+        mcrotate_build(&x->current, x->playing, numchans);
+        x->fade_length = (long)(x->fade * x->samplerate / 1000.);
+        x->fade_pos = 0;
+    }
+
+    if(x->fade_pos < x->fade_length && sampleframes <= x->block_size) {
+        mcrotate_fade_gains(x, sampleframes);
+        mcroute_crossfade(&x->previous, &x->current, ins, inchans, outs, numouts, x->gain_from, x->gain_to, 0, sampleframes);
+        x->fade_pos = MIN(x->fade_pos + sampleframes, x->fade_length);
+        return;
+    }
+
+    mcroute_process(&x->current, ins, inchans, outs, numouts, sampleframes);
 }
 
 void mcrotate_dsp64(t_mcrotate* x, t_object* dsp64, short* count, double samplerate, long maxvectorsize, long flags) {
+    x->samplerate = samplerate;
+    x->rotation_connected = count[1];
+    x->trigger_connected = count[2];
+
+    // fade and pan gains for one block
+    if(maxvectorsize > x->block_size) {
+        sysmem_freeptr(x->gain_from);
+        sysmem_freeptr(x->gain_to);
+        sysmem_freeptr(x->base);
+        x->gain_from = (double*)sysmem_newptr(maxvectorsize * sizeof(double));
+        x->gain_to = (double*)sysmem_newptr(maxvectorsize * sizeof(double));
+        x->base = (long*)sysmem_newptr(maxvectorsize * sizeof(long));
+        x->block_size = maxvectorsize;
+    }
+
     dsp_add64(dsp64, (t_object*)x, (t_perfroutine64)mcrotate_perform64, 0, NULL);
 }
 
 void mcrotate_assist(t_mcrotate* x, void* b, long m, long a, char* s) {
-    if(m == 1) {
-        strcpy(s, "(multi-channel signal) Input");
+    if(m == 1 && a == 2) {
+        strcpy(s, "(signal) Trigger, switches to the next rotation that came in as int");
+    } else if(m == 1 && a == 1) {
+        strcpy(s, "(signal) Rotation in channels, fractions pan between channels");
+    } else if(m == 1) {
+        strcpy(s, "(multi-channel signal) Input, (int) Rotation");
     } else if (m == 2) {
         sprintf(s, "(multi-channel signal) Input, rotated");
     }
@@ -0,0 +1,294 @@
+/*
+ * mc.route~ - route and mix multichannel signals with a sparse matrix
+ * Copyright (C) 2025 Manolo Müller
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License
+ * as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "ext.h"
+#include "ext_obex.h"
+#include "ext_sysmem.h"
+#include "z_dsp.h"
+#include "mcroute.h"
+
+typedef struct _mcroute_connection {
+    int input;
+    int output;
+    double gain;
+} t_mcroute_connection;
+
+typedef struct _mcroute {
+    t_pxobject m_obj;
+    long numchans;      // of the input
+    long chans;         // of the output, 0 follows the input
+    t_bool created;
+    // every connection that was made, the matrix is built from these. they
+    // are kept even if their channels don't exist (yet)
+    t_mcroute_connection* connections;
+    long n_connections;
+    long connections_capacity;
+    long* cursor;       // scratch for building the matrix
+    t_mcroute_buffer routes;
+    t_critical lock;    // messages may come from several threads
+} t_mcroute;
+
+
+void* mcroute_new(t_symbol* s, long argc, t_atom* argv);
+void mcroute_free(t_mcroute* x);
+void mcroute_connect(t_mcroute* x, t_symbol* s, long argc, t_atom* argv);
+void mcroute_disconnect(t_mcroute* x, t_symbol* s, long argc, t_atom* argv);
+void mcroute_list(t_mcroute* x, t_symbol* s, long argc, t_atom* argv);
+void mcroute_clear(t_mcroute* x);
+void mcroute_print(t_mcroute* x);
+t_max_err mcroute_chans_set(t_mcroute* x, void* attr, long argc, t_atom* argv);
+long mcroute_multichanneloutputs(t_mcroute* x, long index);
+long mcroute_inputchanged(t_mcroute* x, long index, long count);
+void mcroute_perform64(t_mcroute* x, t_object* dsp64, double** ins, long numins, double** outs, long numouts, long sampleframes, long flags, void* userparam);
+void mcroute_dsp64(t_mcroute* x, t_object* dsp64, short* count, double samplerate, long maxvectorsize, long flags);
+void mcroute_assist(t_mcroute* x, void* b, long m, long a, char* s);
+
+static t_class* s_mcroute_class;
+
+void ext_main(void* r) {
+    t_class* c = class_new("mc.route~", (method)mcroute_new, (method)mcroute_free, sizeof(t_mcroute), 0L, A_GIMME, 0);
+
+    class_addmethod(c, (method)mcroute_connect,             "connect",             A_GIMME, 0);
+    class_addmethod(c, (method)mcroute_disconnect,          "disconnect",          A_GIMME, 0);
+    class_addmethod(c, (method)mcroute_list,                "list",                A_GIMME, 0);
+    class_addmethod(c, (method)mcroute_clear,               "clear",                     0);
+    class_addmethod(c, (method)mcroute_print,               "print",                     0);
+    class_addmethod(c, (method)mcroute_multichanneloutputs, "multichanneloutputs", A_CANT, 0);
+    class_addmethod(c, (method)mcroute_inputchanged,        "inputchanged",        A_CANT, 0);
+    class_addmethod(c, (method)mcroute_dsp64,               "dsp64",               A_CANT, 0);
+    class_addmethod(c, (method)mcroute_assist,              "assist",              A_CANT, 0);
+
+    CLASS_ATTR_LONG(c, "chans", 0, t_mcroute, chans);
+    CLASS_ATTR_LABEL(c, "chans", 0, "Output Channels (0 Follows The Input)");
+    CLASS_ATTR_ACCESSORS(c, "chans", NULL, mcroute_chans_set);
+
+    class_dspinit(c);
+
+    s_mcroute_class = c;
+    class_register(CLASS_BOX, s_mcroute_class);
+}
+
+void* mcroute_new(t_symbol* s, long argc, t_atom* argv) {
+    t_mcroute* x = (t_mcroute*)object_alloc(s_mcroute_class);
+
+    dsp_setup((t_pxobject*)x, 1);
+    x->m_obj.z_misc |= Z_NO_INPLACE | Z_MC_INLETS;
+    outlet_new((t_object*)x, "multichannelsignal");
+
+    x->numchans = 1;
+    x->chans = 0;
+    x->created = false;
+    x->connections_capacity = 64;
+    x->connections = (t_mcroute_connection*)sysmem_newptr(x->connections_capacity * sizeof(t_mcroute_connection));
+    x->n_connections = 0;
+    x->cursor = (long*)sysmem_newptr(MC_MAX_CHANS * sizeof(long));
+    mcroute_buffer_init(&x->routes, MC_MAX_CHANS);
+    critical_new(&x->lock);
+
+    attr_args_process(x, (short)argc, argv);
+    x->created = true;
+
+    return x;
+}
+
+void mcroute_free(t_mcroute* x) {
+    dsp_free((t_pxobject*)x);
+    critical_free(x->lock);
+    mcroute_buffer_free(&x->routes);
+    sysmem_freeptr(x->connections);
+    sysmem_freeptr(x->cursor);
+}
+
+static long mcroute_numouts(t_mcroute* x) {
+    return x->chans ? x->chans : x->numchans;
+}
+
+// builds the matrix from the connections and hands it to the audio thread.
+// a counting sort by output puts the entries in rows, O(connections + outputs)
+static void mcroute_publish(t_mcroute* x) {
+    t_mcroute_matrix* m = mcroute_buffer_back(&x->routes);
+    long numouts = mcroute_numouts(x);
+    long* rows = m->rows;
+    mcroute_matrix_reserve(m, x->n_connections);
+
+    memset(rows, 0, (numouts + 1) * sizeof(long));
+    for(long c=0; c<x->n_connections; c++) {
+        t_mcroute_connection* con = x->connections + c;
+        if(con->output < numouts && con->input < x->numchans) {
+            rows[con->output + 1]++;
+        }
+    }
+    for(long j=0; j<numouts; j++) {
+        rows[j + 1] += rows[j];
+        x->cursor[j] = rows[j];
+    }
+    for(long c=0; c<x->n_connections; c++) {
+        t_mcroute_connection* con = x->connections + c;
+        if(con->output < numouts && con->input < x->numchans) {
+            long e = x->cursor[con->output]++;
+            m->inputs[e] = con->input;
+            m->gains[e] = con->gain;
+        }
+    }
+
+    m->numins = x->numchans;
+    m->numouts = numouts;
+    m->size = rows[numouts];
+    mcroute_matrix_classify(m);
+
+    mcroute_buffer_publish(&x->routes);
+}
+
+// channels are counted from 1, as everywhere in mc
+static t_bool mcroute_channels(t_mcroute* x, long argc, t_atom* argv, int* input, int* output) {
+    if(argc < 2) {
+        object_error((t_object*)x, "expected an input and an output channel");
+        return false;
+    }
+    long in = atom_getlong(argv);
+    long out = atom_getlong(argv + 1);
+    if(in < 1 || in > MC_MAX_CHANS || out < 1 || out > MC_MAX_CHANS) {
+        object_error((t_object*)x, "channels have to be between 1 and %d", MC_MAX_CHANS);
+        return false;
+    }
+    *input = (int)in - 1;
+    *output = (int)out - 1;
+    return true;
+}
+
+// sets the gain from `input` to `output`, a gain of 0 removes the connection
+static void mcroute_set(t_mcroute* x, int input, int output, double gain) {
+    critical_enter(x->lock);
+
+    long c = 0;
+    for(; c<x->n_connections; c++) {
+        if(x->connections[c].input == input && x->connections[c].output == output) {
+            break;
+        }
+    }
+
+    if(gain == 0) {
+        if(c < x->n_connections) {
+            x->connections[c] = x->connections[--x->n_connections];
+        }
+    } else {
+        if(c == x->n_connections) {
+            if(x->n_connections == x->connections_capacity) {
+                x->connections_capacity *= 2;
+                x->connections = (t_mcroute_connection*)sysmem_resizeptr(x->connections, x->connections_capacity * sizeof(t_mcroute_connection));
+            }
+            x->n_connections++;
+        }
+        x->connections[c].input = input;
+        x->connections[c].output = output;
+        x->connections[c].gain = gain;
+    }
+
+    mcroute_publish(x);
+    critical_exit(x->lock);
+}
+
+// connect <input> <output> [gain]
+void mcroute_connect(t_mcroute* x, t_symbol* s, long argc, t_atom* argv) {
+    int input, output;
+    if(mcroute_channels(x, argc, argv, &input, &output)) {
+        mcroute_set(x, input, output, argc > 2 ? atom_getfloat(argv + 2) : 1);
+    }
+}
+
+// disconnect <input> <output>
+void mcroute_disconnect(t_mcroute* x, t_symbol* s, long argc, t_atom* argv) {
+    int input, output;
+    if(mcroute_channels(x, argc, argv, &input, &output)) {
+        mcroute_set(x, input, output, 0);
+    }
+}
+
+// <input> <output> <gain>, as for matrix~ but counted from 1
+void mcroute_list(t_mcroute* x, t_symbol* s, long argc, t_atom* argv) {
+    int input, output;
+    if(argc < 3) {
+        object_error((t_object*)x, "expected input, output and gain");
+        return;
+    }
+    if(mcroute_channels(x, argc, argv, &input, &output)) {
+        mcroute_set(x, input, output, atom_getfloat(argv + 2));
+    }
+}
+
+void mcroute_clear(t_mcroute* x) {
+    critical_enter(x->lock);
+    x->n_connections = 0;
+    mcroute_publish(x);
+    critical_exit(x->lock);
+}
+
+void mcroute_print(t_mcroute* x) {
+    critical_enter(x->lock);
+    object_post((t_object*)x, "%ld connections", x->n_connections);
+    for(long c=0; c<x->n_connections; c++) {
+        t_mcroute_connection* con = x->connections + c;
+        object_post((t_object*)x, "%d -> %d: %f", con->input + 1, con->output + 1, con->gain);
+    }
+    critical_exit(x->lock);
+}
+
+// the number of outputs decides how the object connects, so it can only be
+// given as an object argument
+t_max_err mcroute_chans_set(t_mcroute* x, void* attr, long argc, t_atom* argv) {
+    if(x->created) {
+        object_error((t_object*)x, "@chans can only be set as an object argument");
+        return MAX_ERR_GENERIC;
+    }
+    if(argc && argv) {
+        x->chans = CLAMP(atom_getlong(argv), 0, MC_MAX_CHANS);
+    }
+    return MAX_ERR_NONE;
+}
+
+long mcroute_multichanneloutputs(t_mcroute* x, long index) {
+    return mcroute_numouts(x);
+}
+
+long mcroute_inputchanged(t_mcroute* x, long index, long count) {
+    if(count != x->numchans) {
+        critical_enter(x->lock);
+        x->numchans = CLAMP(count, 1, MC_MAX_CHANS);
+        mcroute_publish(x);
+        critical_exit(x->lock);
+        return true;
+    }
+    return false;
+}
+
+void mcroute_perform64(t_mcroute* x, t_object* dsp64, double** ins, long numins, double** outs, long numouts, long sampleframes, long flags, void* userparam) {
+    // the newest matrix is taken once per block
+    t_mcroute_matrix* m = mcroute_buffer_take(&x->routes);
+    mcroute_process(m, ins, numins, outs, numouts, sampleframes);
+}
+
+void mcroute_dsp64(t_mcroute* x, t_object* dsp64, short* count, double samplerate, long maxvectorsize, long flags) {
+    dsp_add64(dsp64, (t_object*)x, (t_perfroutine64)mcroute_perform64, 0, NULL);
+}
+
+void mcroute_assist(t_mcroute* x, void* b, long m, long a, char* s) {
+    if(m == 1) {
+        strcpy(s, "(multi-channel signal) Input, (list) input output gain");
+    } else if(m == 2) {
+        sprintf(s, "(multi-channel signal) Output, %ld channels", mcroute_numouts(x));
+    }
+}
@@ -0,0 +1,473 @@
+/*
+ * mcroute.h - sparse routing matrices for multichannel signals
+ * Copyright (C) 2025 Manolo Müller
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License
+ * as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * a routing matrix says which inputs each output plays, and how loud. it is
+ * stored row by row (compressed sparse rows): the entries of output j are
+ * `rows[j]` to `rows[j + 1]`. mc.route~ builds any matrix, mc.rotate~ and
+ * mc.scramble~ only build permutations.
+ *
+ * the kind of a matrix is known once it is built, so the perform routines
+ * pick the cheapest kernel for it:
+ * - permutation: one input per output at unity gain, a plain copy
+ * - scaled: one input per output, a scaled copy
+ * - sparse: a sum of scaled inputs per output
+ *
+ * matrices are allocated once with room for MC_MAX_CHANS outputs, building
+ * one never allocates as long as its entries fit.
+ */
+
+#pragma once
+
+#include "ext.h"
+#include "z_dsp.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+
+enum mcroute_kind { MCROUTE_PERMUTATION=0, MCROUTE_SCALED, MCROUTE_SPARSE };
+
+typedef struct _mcroute_matrix {
+    long numins;
+    long numouts;
+    long kind;
+    long* rows;         // numouts + 1 offsets into inputs and gains
+    int* inputs;
+    double* gains;
+    long size;          // entries in use
+    long capacity;
+} t_mcroute_matrix;
+
+static inline void mcroute_matrix_init(t_mcroute_matrix* m, long capacity) {
+    m->numins = 0;
+    m->numouts = 0;
+    m->kind = MCROUTE_PERMUTATION;
+    m->rows = (long*)sysmem_newptrclear((MC_MAX_CHANS + 1) * sizeof(long));
+    m->inputs = (int*)sysmem_newptr(capacity * sizeof(int));
+    m->gains = (double*)sysmem_newptr(capacity * sizeof(double));
+    m->size = 0;
+    m->capacity = capacity;
+}
+
+static inline void mcroute_matrix_free(t_mcroute_matrix* m) {
+    sysmem_freeptr(m->rows);
+    sysmem_freeptr(m->inputs);
+    sysmem_freeptr(m->gains);
+}
+
+// makes room for `capacity` entries. only for matrices that aren't played
+static inline void mcroute_matrix_reserve(t_mcroute_matrix* m, long capacity) {
+    if(capacity > m->capacity) {
+        sysmem_freeptr(m->inputs);
+        sysmem_freeptr(m->gains);
+        m->inputs = (int*)sysmem_newptr(capacity * sizeof(int));
+        m->gains = (double*)sysmem_newptr(capacity * sizeof(double));
+        m->capacity = capacity;
+    }
+}
+
+// starts an empty matrix. the outputs are then added in order, each with
+// mcroute_matrix_add for its inputs and mcroute_matrix_end_row
+static inline void mcroute_matrix_begin(t_mcroute_matrix* m, long numins) {
+    m->numins = numins;
+    m->numouts = 0;
+    m->kind = MCROUTE_PERMUTATION;
+    m->rows[0] = 0;
+    m->size = 0;
+}
+
+static inline void mcroute_matrix_add(t_mcroute_matrix* m, int input, double gain) {
+    m->inputs[m->size] = input;
+    m->gains[m->size] = gain;
+    m->size++;
+    if(gain != 1 && m->kind == MCROUTE_PERMUTATION) {
+        m->kind = MCROUTE_SCALED;
+    }
+}
+
+static inline void mcroute_matrix_end_row(t_mcroute_matrix* m) {
+    if(m->size - m->rows[m->numouts] != 1) {
+        m->kind = MCROUTE_SPARSE;
+    }
+    m->numouts++;
+    m->rows[m->numouts] = m->size;
+}
+
+// works out the kind of a matrix whose rows were written directly
+static inline void mcroute_matrix_classify(t_mcroute_matrix* m) {
+    m->kind = MCROUTE_PERMUTATION;
+    for(long j=0; j<m->numouts; j++) {
+        if(m->rows[j + 1] - m->rows[j] != 1) {
+            m->kind = MCROUTE_SPARSE;
+            return;
+        }
+        if(m->gains[m->rows[j]] != 1) {
+            m->kind = MCROUTE_SCALED;
+        }
+    }
+}
+
+// false if `src` doesn't fit
+static inline bool mcroute_matrix_copy(t_mcroute_matrix* dst, const t_mcroute_matrix* src) {
+    if(src->size > dst->capacity) {
+        return false;
+    }
+    dst->numins = src->numins;
+    dst->numouts = src->numouts;
+    dst->kind = src->kind;
+    dst->size = src->size;
+    sysmem_copyptr(src->rows, dst->rows, (src->numouts + 1) * sizeof(long));
+    sysmem_copyptr(src->inputs, dst->inputs, src->size * sizeof(int));
+    sysmem_copyptr(src->gains, dst->gains, src->size * sizeof(double));
+    return true;
+}
+
+// kernels, all of them are simple loops the compiler can vectorize
+
+static inline void mcroute_scale(double* out, const double* in, double gain, long n) {
+    for(long k=0; k<n; k++) {
+        out[k] = in[k] * gain;
+    }
+}
+
+static inline void mcroute_axpy(double* out, const double* in, double gain, long n) {
+    for(long k=0; k<n; k++) {
+        out[k] += in[k] * gain;
+    }
+}
+
+static inline void mcroute_ramp_axpy(double* out, const double* in, double gain, const double* ramp, long n) {
+    for(long k=0; k<n; k++) {
+        out[k] += in[k] * ramp[k] * gain;
+    }
+}
+
+static inline void mcroute_mix(double* out, const double* from, const double* to, const double* gain_from, const double* gain_to, long n) {
+    for(long k=0; k<n; k++) {
+        out[k] = from[k] * gain_from[k] + to[k] * gain_to[k];
+    }
+}
+
+// a matrix built for more inputs than there are (the channel count just
+// changed) has to check every entry
+static inline long mcroute_kind(const t_mcroute_matrix* m, long numins) {
+    return m->numins <= numins ? m->kind : MCROUTE_SPARSE;
+}
+
+// adds the entries of output `j` times `ramp` to `out`
+static inline void mcroute_ramp_row(const t_mcroute_matrix* m, long j, double** ins, long numins, double* out, const double* ramp, long offset, long n) {
+    for(long e=m->rows[j]; e<m->rows[j + 1]; e++) {
+        if(m->inputs[e] < numins) {
+            mcroute_ramp_axpy(out, ins[m->inputs[e]] + offset, m->gains[e], ramp, n);
+        }
+    }
+}
+
+// outs = m * ins for `n` samples from `offset`. outputs without a row are
+// silent
+static inline void mcroute_process_part(const t_mcroute_matrix* m, double** ins, long numins, double** outs, long numouts, long offset, long n) {
+    long rows = MIN(m->numouts, numouts);
+    const long* r = m->rows;
+
+    switch(mcroute_kind(m, numins)) {
+        case MCROUTE_PERMUTATION:
+            for(long j=0; j<rows; j++) {
+                sysmem_copyptr(ins[m->inputs[r[j]]] + offset, outs[j] + offset, n * sizeof(double));
+            }
+            break;
+        case MCROUTE_SCALED:
+            for(long j=0; j<rows; j++) {
+                mcroute_scale(outs[j] + offset, ins[m->inputs[r[j]]] + offset, m->gains[r[j]], n);
+            }
+            break;
+        default:
+            for(long j=0; j<rows; j++) {
+                double* out = outs[j] + offset;
+                set_zero64(out, n);
+                for(long e=r[j]; e<r[j + 1]; e++) {
+                    if(m->inputs[e] < numins) {
+                        mcroute_axpy(out, ins[m->inputs[e]] + offset, m->gains[e], n);
+                    }
+                }
+            }
+            break;
+    }
+
+    for(long j=rows; j<numouts; j++) {
+        set_zero64(outs[j] + offset, n);
+    }
+}
+
+// outs = m * ins for one block
+static inline void mcroute_process(const t_mcroute_matrix* m, double** ins, long numins, double** outs, long numouts, long n) {
+    mcroute_process_part(m, ins, numins, outs, numouts, 0, n);
+}
+
+// outs = gain_a * (a * ins) + gain_b * (b * ins), with gains per sample, for
+// `n` samples from `offset`. fading between two matrices and panning between
+// two rotations are both this
+static inline void mcroute_crossfade(const t_mcroute_matrix* a, const t_mcroute_matrix* b, double** ins, long numins, double** outs, long numouts, const double* gain_a, const double* gain_b, long offset, long n) {
+    long rows = MIN(MIN(a->numouts, b->numouts), numouts);
+
+    if(mcroute_kind(a, numins) == MCROUTE_PERMUTATION && mcroute_kind(b, numins) == MCROUTE_PERMUTATION) {
+        // one read of each input, the common case
+        for(long j=0; j<rows; j++) {
+            double* from = ins[a->inputs[a->rows[j]]] + offset;
+            double* to = ins[b->inputs[b->rows[j]]] + offset;
+            if(from == to) {
+                sysmem_copyptr(to, outs[j] + offset, n * sizeof(double));
+            } else {
+                mcroute_mix(outs[j] + offset, from, to, gain_a, gain_b, n);
+            }
+        }
+    } else {
+        for(long j=0; j<rows; j++) {
+            double* out = outs[j] + offset;
+            set_zero64(out, n);
+            mcroute_ramp_row(a, j, ins, numins, out, gain_a, offset, n);
+            mcroute_ramp_row(b, j, ins, numins, out, gain_b, offset, n);
+        }
+    }
+
+    for(long j=rows; j<numouts; j++) {
+        set_zero64(outs[j] + offset, n);
+    }
+}
+
+/*
+ * triple buffer for handing matrices to the audio thread: the back matrix is
+ * built by the main thread, the front matrix is played by the audio thread,
+ * and the shared one is swapped with either of them atomically. no matrix is
+ * ever freed or written while the audio thread reads it.
+ * only one thread may build and publish at a time.
+ */
+
+// marks the shared matrix as newer than the front one
+#define MCROUTE_FRESH 4
+
+typedef struct _mcroute_buffer {
+    t_mcroute_matrix matrices[3];
+    long back;
+    long front;
+    _Atomic long shared;    // index of the shared matrix | MCROUTE_FRESH
+} t_mcroute_buffer;
+
+static inline void mcroute_buffer_init(t_mcroute_buffer* b, long capacity) {
+    for(int i=0; i<3; i++) {
+        mcroute_matrix_init(b->matrices + i, capacity);
+    }
+    b->back = 0;
+    b->front = 1;
+    atomic_init(&b->shared, 2);
+}
+
+static inline void mcroute_buffer_free(t_mcroute_buffer* b) {
+    for(int i=0; i<3; i++) {
+        mcroute_matrix_free(b->matrices + i);
+    }
+}
+
+static inline t_mcroute_matrix* mcroute_buffer_back(t_mcroute_buffer* b) {
+    return b->matrices + b->back;
+}
+
+// hands the back matrix to the audio thread and takes the shared one back
+static inline void mcroute_buffer_publish(t_mcroute_buffer* b) {
+    long shared = atomic_exchange_explicit(&b->shared, b->back | MCROUTE_FRESH, memory_order_acq_rel);
+    b->back = shared & ~MCROUTE_FRESH;
+}
+
+// audio thread
+
+static inline t_mcroute_matrix* mcroute_buffer_front(t_mcroute_buffer* b) {
+    return b->matrices + b->front;
+}
+
+static inline bool mcroute_buffer_fresh(t_mcroute_buffer* b) {
+    return atomic_load_explicit(&b->shared, memory_order_relaxed) & MCROUTE_FRESH;
+}
+
+// makes the newest matrix the front one, if there is one
+static inline t_mcroute_matrix* mcroute_buffer_take(t_mcroute_buffer* b) {
+    if(mcroute_buffer_fresh(b)) {
+        b->front = atomic_exchange_explicit(&b->shared, b->front, memory_order_acq_rel) & ~MCROUTE_FRESH;
+    }
+    return b->matrices + b->front;
+}
+
+/*
+ * queue of matrices that are built ahead of time, for switching at a given
+ * sample: the main thread builds them, the audio thread copies the next one
+ * into a matrix of its own whenever it is triggered, so the slot can be
+ * built again right away. only one thread may build and push at a time.
+ *
+ * when the channel count changes, the builder invalidates the queue and can
+ * build up to MCROUTE_QUEUE_DEPTH new matrices at once, in the slots behind
+ * the invalid ones. the audio thread drops the invalid ones before it takes
+ * the next one. while the audio thread doesn't run, the builder drops them
+ * itself, so any number of changes can happen before dsp starts.
+ */
+
+#define MCROUTE_QUEUE_DEPTH 8   // matrices built ahead
+#define MCROUTE_QUEUE_SIZE 16   // power of two, room for the invalid ones
+
+typedef struct _mcroute_queue {
+    t_mcroute_matrix matrices[MCROUTE_QUEUE_SIZE];
+    _Atomic long head;      // next matrix to be built
+    _Atomic long tail;      // next matrix to be taken
+    _Atomic long valid;     // first matrix that isn't invalid
+} t_mcroute_queue;
+
+static inline void mcroute_queue_init(t_mcroute_queue* q, long capacity) {
+    for(int i=0; i<MCROUTE_QUEUE_SIZE; i++) {
+        mcroute_matrix_init(q->matrices + i, capacity);
+    }
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->valid, 0);
+}
+
+static inline void mcroute_queue_free(t_mcroute_queue* q) {
+    for(int i=0; i<MCROUTE_QUEUE_SIZE; i++) {
+        mcroute_matrix_free(q->matrices + i);
+    }
+}
+
+// the matrix to build next, NULL if MCROUTE_QUEUE_DEPTH valid matrices are
+// waiting or there is no free slot
+static inline t_mcroute_matrix* mcroute_queue_back(t_mcroute_queue* q) {
+    long head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    long tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    long valid = atomic_load_explicit(&q->valid, memory_order_relaxed);
+    if(head - MAX(tail, valid) >= MCROUTE_QUEUE_DEPTH || head - tail >= MCROUTE_QUEUE_SIZE) {
+        return NULL;
+    }
+    return q->matrices + (head & (MCROUTE_QUEUE_SIZE - 1));
+}
+
+static inline void mcroute_queue_push(t_mcroute_queue* q) {
+    long head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+}
+
+// marks all matrices that are waiting as invalid, e.g. because they were
+// built for another number of channels. `running` says if the audio thread
+// may take from the queue meanwhile (sys_getdspobjdspstate), if it can't,
+// the invalid matrices are dropped right away
+static inline void mcroute_queue_invalidate(t_mcroute_queue* q, bool running) {
+    long head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    if(!running) {
+        atomic_store_explicit(&q->tail, head, memory_order_release);
+    }
+    atomic_store_explicit(&q->valid, head, memory_order_release);
+}
+
+// audio thread
+
+// the next matrix, NULL if there is none. it stays in the queue until popped
+static inline t_mcroute_matrix* mcroute_queue_front(t_mcroute_queue* q) {
+    long tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    long head = atomic_load_explicit(&q->head, memory_order_acquire);
+    if(tail == head) {
+        return NULL;
+    }
+    return q->matrices + (tail & (MCROUTE_QUEUE_SIZE - 1));
+}
+
+// hands the front matrix back to the main thread
+static inline void mcroute_queue_pop(t_mcroute_queue* q) {
+    long tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+}
+
+// drops the invalid matrices. returns how many were dropped
+static inline long mcroute_queue_drop_stale(t_mcroute_queue* q) {
+    long tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    long valid = atomic_load_explicit(&q->valid, memory_order_acquire);
+    if(tail >= valid) {
+        return 0;
+    }
+    atomic_store_explicit(&q->tail, valid, memory_order_release);
+    return valid - tail;
+}
+
+// the first rising edge of `trigger` (from 0 or below to above 0) from
+// `start` on, `n` if there is none. `previous` is the sample before `start`
+static inline long mcroute_trigger_edge(const double* trigger, double previous, long start, long n) {
+    for(long k=start; k<n; k++) {
+        if(trigger[k] > 0 && previous <= 0) {
+            return k;
+        }
+        previous = trigger[k];
+    }
+    return n;
+}
+
+// plays `*m` from sample `offset` on and switches to the next matrix of the
+// queue at every rising edge of `trigger`, so the part of the block before
+// the edge is played with the old matrix and the rest with the new one. the
+// new matrix is copied into `current`, which is where `*m` points afterwards.
+// `last` is the last trigger sample of the previous block. an edge without a
+// matrix in the queue keeps the old one.
+// returns how many matrices were taken or dropped from the queue
+static inline long mcroute_process_triggered(t_mcroute_queue* q, t_mcroute_matrix* current, t_mcroute_matrix** m, double* last, const double* trigger, double** ins, long numins, double** outs, long numouts, long offset, long n) {
+    long taken = mcroute_queue_drop_stale(q);
+    long start = offset;
+    double previous = offset ? trigger[offset - 1] : *last;
+
+    for(long k = mcroute_trigger_edge(trigger, previous, offset, n); k < n; k = mcroute_trigger_edge(trigger, trigger[k], k + 1, n)) {
+        t_mcroute_matrix* next = mcroute_queue_front(q);
+        if(next) {
+            mcroute_process_part(*m, ins, numins, outs, numouts, start, k - start);
+            if(mcroute_matrix_copy(current, next)) {
+                *m = current;
+            }
+            mcroute_queue_pop(q);
+            taken++;
+            start = k;
+        }
+    }
+
+    mcroute_process_part(*m, ins, numins, outs, numouts, start, n - start);
+    if(n > 0) {
+        *last = trigger[n - 1];
+    }
+    return taken;
+}
+
+// takes the matrices of the queue at the rising edges of `trigger` like
+// mcroute_process_triggered, but doesn't play them, for blocks where
+// something else is played. the triggers still count, and `*m` points to
+// the last one taken
+static inline long mcroute_follow_triggered(t_mcroute_queue* q, t_mcroute_matrix* current, t_mcroute_matrix** m, double* last, const double* trigger, long n) {
+    long taken = mcroute_queue_drop_stale(q);
+
+    for(long k = mcroute_trigger_edge(trigger, *last, 0, n); k < n; k = mcroute_trigger_edge(trigger, trigger[k], k + 1, n)) {
+        t_mcroute_matrix* next = mcroute_queue_front(q);
+        if(next) {
+            if(mcroute_matrix_copy(current, next)) {
+                *m = current;
+            }
+            mcroute_queue_pop(q);
+            taken++;
+        }
+    }
+
+    if(n > 0) {
+        *last = trigger[n - 1];
+    }
+    return taken;
+}
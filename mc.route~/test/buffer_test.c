@@ -0,0 +1,140 @@
+/*
+ * buffer_test.c - stress test of the triple buffer in mcroute.h
+ * Copyright (C) 2025 Manolo Müller
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License
+ * as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * one thread builds and publishes matrices as fast as it can, the other
+ * takes them and plays a block with each, like the main and the audio
+ * thread. every matrix is stamped with its number in all of its entries,
+ * so the player can tell if one was written while it was played (torn),
+ * if an older one came back after a newer one, or if the last one never
+ * arrived. the size changes with every matrix, so the copies differ.
+ */
+
+#include "mcroute.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+
+#define PUBLISHES 200000
+#define BLOCK 16
+
+static t_mcroute_buffer s_buffer;
+static atomic_bool s_done;
+
+static long size_of(long stamp) {
+    return 1 + stamp % 64;
+}
+
+static void* produce(void* arg) {
+    for(long stamp=1; stamp<=PUBLISHES; stamp++) {
+        t_mcroute_matrix* m = mcroute_buffer_back(&s_buffer);
+        long n = size_of(stamp);
+        mcroute_matrix_begin(m, stamp);
+        for(long j=0; j<n; j++) {
+            mcroute_matrix_add(m, (int)(stamp & 0xffff), (double)stamp);
+            mcroute_matrix_end_row(m);
+        }
+        mcroute_buffer_publish(&s_buffer);
+        // lets the player in on machines with a single core
+        if(stamp % 4 == 0) {
+            sched_yield();
+        }
+    }
+    atomic_store(&s_done, true);
+    return NULL;
+}
+
+// checks that all of `m` belongs to the same publish, returns its stamp
+static long check(const t_mcroute_matrix* m, long* torn) {
+    long stamp = m->numins;
+    if(stamp == 0) {
+        return 0;   // nothing published yet
+    }
+    long n = size_of(stamp);
+    if(m->numouts != n || m->size != n || m->kind != MCROUTE_SCALED) {
+        (*torn)++;
+        return stamp;
+    }
+    for(long j=0; j<n; j++) {
+        if(m->rows[j] != j || m->inputs[j] != (int)(stamp & 0xffff) || m->gains[j] != (double)stamp) {
+            (*torn)++;
+            break;
+        }
+    }
+    return stamp;
+}
+
+int main(void) {
+    mcroute_buffer_init(&s_buffer, MC_MAX_CHANS);
+    atomic_init(&s_done, false);
+
+    double in[BLOCK];
+    double out_blocks[64][BLOCK];
+    double* ins[1] = {in};
+    double* outs[64];
+    for(long k=0; k<BLOCK; k++) {
+        in[k] = 1;
+    }
+    for(long j=0; j<64; j++) {
+        outs[j] = out_blocks[j];
+    }
+
+    pthread_t producer;
+    pthread_create(&producer, NULL, produce, NULL);
+
+    long blocks = 0;
+    long torn = 0;
+    long backwards = 0;
+    long taken = 0;
+    long last = 0;
+    bool done = false;
+    while(!done) {
+        // read before taking, so the newest matrix is taken once more
+        done = atomic_load(&s_done);
+        bool fresh = mcroute_buffer_fresh(&s_buffer);
+        t_mcroute_matrix* m = mcroute_buffer_take(&s_buffer);
+        long stamp = check(m, &torn);
+        if(stamp < last) {
+            backwards++;
+        }
+        taken += fresh;
+        last = stamp;
+        // the inputs are stamps, not channels, so every output plays the
+        // one input with its gain. the builder gets to run in the middle of
+        // the block, and the matrix must not change meanwhile
+        for(long j=0; j<m->numouts; j++) {
+            mcroute_scale(outs[j], ins[0], m->gains[j], BLOCK);
+        }
+        sched_yield();
+        if(check(m, &torn) != stamp) {
+            torn++;
+        }
+        blocks++;
+    }
+    pthread_join(producer, NULL);
+
+    printf("%ld blocks, %ld matrices taken of %d published\n", blocks, taken, PUBLISHES);
+    printf("torn %ld, older after newer %ld, last %ld\n", torn, backwards, last);
+    mcroute_buffer_free(&s_buffer);
+
+    if(torn || backwards || last != PUBLISHES) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * queue_test.c - stress test of the trigger queue in mcroute.h
+ * Copyright (C) 2025 Manolo Müller
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License
+ * as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * one thread keeps the queue filled and now and then invalidates it, like a
+ * channel count change, the other drops the invalid matrices and takes the
+ * rest, like the audio thread at a trigger. every matrix carries its number
+ * in the queue in all of its entries, so the taker can tell if a slot was
+ * built again while it was still being copied, or if a matrix came out of
+ * order or after it was invalidated. right after an invalidation the
+ * builder must be able to build a full set of new matrices at once, as long
+ * as the taker ran since the invalidation before, or doesn't run at all.
+ * some invalidations follow each other at once, so all slots get used.
+ */
+
+#include "mcroute.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+
+#define INVALIDATIONS 20000
+#define CHANS 8
+
+static t_mcroute_queue s_queue;
+static atomic_bool s_done;
+static long s_short = 0;    // invalidations after which the queue couldn't be refilled
+
+static long fill(long head) {
+    t_mcroute_matrix* m;
+    long built = 0;
+    while((m = mcroute_queue_back(&s_queue))) {
+        mcroute_matrix_begin(m, head);
+        for(long j=0; j<CHANS; j++) {
+            mcroute_matrix_add(m, (int)(head & 0xffff), (double)head);
+            mcroute_matrix_end_row(m);
+        }
+        mcroute_queue_push(&s_queue);
+        head++;
+        built++;
+    }
+    return built;
+}
+
+static long invalidate(long head, bool running, bool full) {
+    mcroute_queue_invalidate(&s_queue, running);
+    long built = fill(head);
+    if(full && built != MCROUTE_QUEUE_DEPTH) {
+        s_short++;
+    }
+    return head + built;
+}
+
+static void* build(void* arg) {
+    long head = atomic_load(&s_queue.head);
+    for(long i=0; i<INVALIDATIONS; i++) {
+        // usually a change comes after the taker had a block to drop what
+        // the one before invalidated, but some come at once and fill all
+        // slots
+        bool wait = i % 4;
+        while(wait && atomic_load(&s_queue.tail) < atomic_load(&s_queue.valid)) {
+            sched_yield();
+        }
+        head += fill(head);
+        sched_yield();
+        head = invalidate(head, true, wait);
+    }
+    atomic_store(&s_done, true);
+    return NULL;
+}
+
+static bool intact(const t_mcroute_matrix* m, long stamp) {
+    if(m->numins != stamp || m->numouts != CHANS || m->size != CHANS) {
+        return false;
+    }
+    for(long j=0; j<CHANS; j++) {
+        if(m->rows[j] != j || m->inputs[j] != (int)(stamp & 0xffff) || m->gains[j] != (double)stamp) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(void) {
+    mcroute_queue_init(&s_queue, MC_MAX_CHANS);
+    atomic_init(&s_done, false);
+
+    // before dsp starts, any number of changes in a row
+    long head = fill(0);
+    for(long i=0; i<100; i++) {
+        head = invalidate(head, false, true);
+    }
+    if(mcroute_queue_drop_stale(&s_queue) != 0) {
+        s_short++;
+    }
+
+    // while dsp runs but the taker is behind, the slots it may still read
+    // are never built again
+    long overrun = 0;
+    for(long i=0; i<3; i++) {
+        head = invalidate(head, true, i == 0);
+        overrun += head - atomic_load(&s_queue.tail) > MCROUTE_QUEUE_SIZE;
+    }
+    if(overrun || mcroute_queue_drop_stale(&s_queue) != 2 * MCROUTE_QUEUE_DEPTH) {
+        printf("FAIL the builder overran the taker\n");
+        return 1;
+    }
+
+    t_mcroute_matrix current;
+    mcroute_matrix_init(&current, MC_MAX_CHANS);
+
+    pthread_t builder;
+    pthread_create(&builder, NULL, build, NULL);
+
+    long taken = 0;
+    long dropped = 0;
+    long torn = 0;
+    long invalid = 0;
+    long last = atomic_load(&s_queue.tail) - 1;
+    while(!atomic_load(&s_done)) {
+        dropped += mcroute_queue_drop_stale(&s_queue);
+        long valid = atomic_load(&s_queue.valid);
+        t_mcroute_matrix* m = mcroute_queue_front(&s_queue);
+        if(m) {
+            long stamp = atomic_load(&s_queue.tail);
+            // the copy takes time, and the slot must not be built again
+            // meanwhile
+            if(!intact(m, stamp)) {
+                torn++;
+            }
+            sched_yield();
+            mcroute_matrix_copy(&current, m);
+            if(!intact(&current, stamp)) {
+                torn++;
+            }
+            if(stamp <= last || stamp < valid) {
+                invalid++;
+            }
+            last = stamp;
+            mcroute_queue_pop(&s_queue);
+            taken++;
+        }
+        sched_yield();
+    }
+    pthread_join(builder, NULL);
+
+    printf("%ld taken, %ld dropped, %d invalidations\n", taken, dropped, INVALIDATIONS);
+    printf("torn %ld, out of order or invalid %ld, not refilled at once %ld\n", torn, invalid, s_short);
+    mcroute_matrix_free(&current);
+    mcroute_queue_free(&s_queue);
+
+    if(torn || invalid || s_short || !taken || !dropped) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
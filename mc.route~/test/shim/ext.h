@@ -0,0 +1,35 @@
+/*
+ * ext.h - the parts of the max api that mcroute.h uses, so its tests can
+ * be built without the max sdk. not used by the externals themselves.
+ */
+
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MC_MAX_CHANS 1024
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+static inline void* sysmem_newptr(long size) {
+    return malloc(size);
+}
+
+static inline void* sysmem_newptrclear(long size) {
+    return calloc(1, size);
+}
+
+static inline void sysmem_freeptr(void* p) {
+    free(p);
+}
+
+static inline void sysmem_copyptr(const void* src, void* dst, long bytes) {
+    memmove(dst, src, bytes);
+}
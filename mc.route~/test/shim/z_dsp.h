@@ -0,0 +1,11 @@
+/*
+ * z_dsp.h - see ext.h next to it
+ */
+
+#pragma once
+
+#include <string.h>
+
+static inline void set_zero64(double* p, long n) {
+    memset(p, 0, n * sizeof(double));
+}
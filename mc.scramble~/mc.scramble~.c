@@ -18,147 +18,644 @@
 #include "ext.h"
 #include "ext_obex.h"
 #include "ext_sysmem.h"
+#include "ext_systime.h"
+#include "ext_buffer.h"
+#include "ext_dictobj.h"
 #include "z_dsp.h"
+#include "mcroute.h"
+#include "scramble.h"
+#include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 enum mcscramble_state { LINEAR=0, SCRAMBLED};
+enum mcscramble_mode { SHUFFLE=0, DERANGE, CYCLE, LOCAL };
+
+// a table of permutations in one block: with entry e, output j plays input
+// sources[e * chans + j]
+typedef struct _mcscramble_table {
+    long chans;
+    long size;          // number of entries
+    int* sources;
+} t_mcscramble_table;
 
 typedef struct _mcscramble {
     t_pxobject m_obj;
     long numchans;
-    int* index_map;
+    int* index_map;     // input i goes to output index_map[i]
+    // the permutations are built by bang and reset and handed to the audio
+    // thread as routing matrices
+    t_mcroute_buffer routes;
+    // scrambles for the trigger inlet are built ahead of time and refilled
+    // by a clock whenever the audio thread took some
+    t_mcroute_queue queue;
+    int* queue_map;
+    void* refill;
+    t_critical lock;        // messages and the refill may come from several threads
     enum mcscramble_state state;
+    long mode;
+    long distance;      // how far a channel may move with @mode local
+    long seed;          // 0 seeds from the time
+    t_scramble_rng rng;
+    // the trigger queue has its own stream, so what bang plays doesn't
+    // depend on when the queue was refilled
+    t_scramble_rng queue_rng;
+    double* keys;       // scratch for @mode local, MC_MAX_CHANS long
+    int* order;
+    t_mcroute_matrix fading;    // audio thread only, the matrix that is faded out
+    double fade;        // crossfade time in ms, 0 switches at once
+    long fade_length;   // in samples
+    long fade_pos;      // fade_length when no fade is running
+    double* gain_from;  // per-sample fade gains, shared by all channels
+    double* gain_to;
+    long block_size;
+    double samplerate;
+    t_mcroute_matrix triggered; // the last scramble taken from the queue
+    t_mcroute_matrix* playing;  // audio thread only
+    short trigger_connected;
+    double trigger_last;
+    // a loaded table goes to the audio thread through `table_pending`, and
+    // the one it replaced comes back through `table_retired` to be freed
+    _Atomic(t_mcscramble_table*) table_pending;
+    _Atomic(t_mcscramble_table*) table_retired;
+    void* collect;
+    long table_size;        // of the newest table, for checking the selection
+    long table_chans;
+    long table_selected;    // -1 while bang and reset are played
+    _Atomic long table_index;
+    // audio thread only: the table and entry that are played. an entry is
+    // played in place, through a matrix that points into the table
+    t_mcscramble_table* table;
+    long table_playing;
+    t_mcroute_matrix table_view;
+    long* table_rows;       // 0, 1, 2, ... for every entry
+    double* table_gains;    // all 1
 } t_mcscramble;
 
 
-void* mcscramble_new(void);
+void* mcscramble_new(t_symbol* s, long argc, t_atom* argv);
 void mcscramble_free(t_mcscramble* x);
 void mcscramble_reset(t_mcscramble* x);
 void mcscramble_bang(t_mcscramble* x);
+void mcscramble_refill(t_mcscramble* x);
+void mcscramble_int(t_mcscramble* x, long n);
+void mcscramble_next_entry(t_mcscramble* x);
+void mcscramble_prev_entry(t_mcscramble* x);
+void mcscramble_table(t_mcscramble* x, t_symbol* s, long argc, t_atom* argv);
+void mcscramble_dictionary(t_mcscramble* x, t_symbol* name);
+void mcscramble_buffer(t_mcscramble* x, t_symbol* s, long argc, t_atom* argv);
+void mcscramble_collect(t_mcscramble* x);
+t_max_err mcscramble_seed_set(t_mcscramble* x, void* attr, long argc, t_atom* argv);
+t_max_err mcscramble_mode_set(t_mcscramble* x, void* attr, long argc, t_atom* argv);
+t_max_err mcscramble_distance_set(t_mcscramble* x, void* attr, long argc, t_atom* argv);
 long mcscramble_multichanneloutputs(t_mcscramble* x, long index);
 long mcscramble_inputchanged(t_mcscramble* x, long index, long count);
 void mcscramble_perform(t_mcscramble* x, t_object* dsp64, double** ins, long numins, double** outs, long numouts, long sampleframes, long flags, void* userparam);
 void mcscramble_dsp64(t_mcscramble* x, t_object* dsp64, short* count, double samplerate, long maxvectorsize, long flags);
 void mcscramble_assist(t_mcscramble* x, void* b, long m, long a, char* s);
 
+static void mcscramble_table_free(t_mcscramble_table* t);
+static void mcscramble_requeue(t_mcscramble* x);
+
 static t_class* s_mcscramble_class;
 
 void ext_main(void* r)
 {
-    t_class* c = class_new("mc.scramble~", (method)mcscramble_new, (method)mcscramble_free, sizeof(t_mcscramble), 0L, 0);
+    t_class* c = class_new("mc.scramble~", (method)mcscramble_new, (method)mcscramble_free, sizeof(t_mcscramble), 0L, A_GIMME, 0);
 
     class_addmethod(c, (method)mcscramble_bang,                "bang",                        0);
     class_addmethod(c, (method)mcscramble_reset,               "reset",                       0);
+    class_addmethod(c, (method)mcscramble_int,                 "int",                    A_LONG, 0);
+    class_addmethod(c, (method)mcscramble_next_entry,          "next",                        0);
+    class_addmethod(c, (method)mcscramble_prev_entry,          "prev",                        0);
+    class_addmethod(c, (method)mcscramble_table,               "table",                 A_GIMME, 0);
+    class_addmethod(c, (method)mcscramble_dictionary,          "dictionary",              A_SYM, 0);
+    class_addmethod(c, (method)mcscramble_buffer,              "buffer",                A_GIMME, 0);
     class_addmethod(c, (method)mcscramble_multichanneloutputs, "multichanneloutputs", A_CANT, 0);
     class_addmethod(c, (method)mcscramble_inputchanged,        "inputchanged",        A_CANT, 0);
     class_addmethod(c, (method)mcscramble_dsp64,               "dsp64",                  A_CANT, 0);
     class_addmethod(c, (method)mcscramble_assist,              "assist",              A_CANT, 0);
 
+    CLASS_ATTR_LONG(c, "mode", 0, t_mcscramble, mode);
+    CLASS_ATTR_ENUMINDEX(c, "mode", 0, "shuffle derange cycle local");
+    CLASS_ATTR_LABEL(c, "mode", 0, "Scramble Mode");
+    CLASS_ATTR_FILTER_CLIP(c, "mode", SHUFFLE, LOCAL);
+    CLASS_ATTR_ACCESSORS(c, "mode", NULL, mcscramble_mode_set);
+
+    CLASS_ATTR_LONG(c, "distance", 0, t_mcscramble, distance);
+    CLASS_ATTR_LABEL(c, "distance", 0, "Maximum Distance For Local Mode");
+    CLASS_ATTR_FILTER_MIN(c, "distance", 1);
+    CLASS_ATTR_ACCESSORS(c, "distance", NULL, mcscramble_distance_set);
+
+    CLASS_ATTR_LONG(c, "seed", 0, t_mcscramble, seed);
+    CLASS_ATTR_LABEL(c, "seed", 0, "Random Seed (0 For Time)");
+    CLASS_ATTR_ACCESSORS(c, "seed", NULL, mcscramble_seed_set);
+
+    CLASS_ATTR_DOUBLE(c, "fade", 0, t_mcscramble, fade);
+    CLASS_ATTR_LABEL(c, "fade", 0, "Crossfade Time (ms)");
+    CLASS_ATTR_FILTER_MIN(c, "fade", 0);
+
     class_dspinit(c);
 
     s_mcscramble_class = c;
     class_register(CLASS_BOX, s_mcscramble_class);
 }
 
-void* mcscramble_new(void) {
+void* mcscramble_new(t_symbol* s, long argc, t_atom* argv) {
     t_mcscramble* x = (t_mcscramble*)object_alloc(s_mcscramble_class);
 
-    dsp_setup((t_pxobject*)x, 1);
+    // the right inlet triggers the prepared scrambles
+    dsp_setup((t_pxobject*)x, 2);
     x->m_obj.z_misc |= Z_NO_INPLACE | Z_MC_INLETS;
     outlet_new((t_object*)x, "multichannelsignal");
 
     x->numchans = 1;
-    x->index_map = (int*)sysmem_newptrclear(x->numchans * sizeof(int));
+    x->index_map = (int*)sysmem_newptr(MC_MAX_CHANS * sizeof(int));
+    mcroute_buffer_init(&x->routes, MC_MAX_CHANS);
+    mcroute_queue_init(&x->queue, MC_MAX_CHANS);
+    mcroute_matrix_init(&x->triggered, MC_MAX_CHANS);
+    x->queue_map = (int*)sysmem_newptr(MC_MAX_CHANS * sizeof(int));
+    x->refill = clock_new(x, (method)mcscramble_refill);
+    critical_new(&x->lock);
+    x->keys = (double*)sysmem_newptr(MC_MAX_CHANS * sizeof(double));
+    x->order = (int*)sysmem_newptr(MC_MAX_CHANS * sizeof(int));
+    x->mode = SHUFFLE;
+    x->distance = 1;
+    mcroute_matrix_init(&x->fading, MC_MAX_CHANS);
+    x->fade = 0;
+    x->fade_length = 0;
+    x->fade_pos = 0;
+    x->gain_from = NULL;
+    x->gain_to = NULL;
+    x->block_size = 0;
+    x->samplerate = 44100;
+    x->playing = mcroute_buffer_front(&x->routes);
+    x->trigger_connected = 0;
+    x->trigger_last = 0;
+    atomic_init(&x->table_pending, NULL);
+    atomic_init(&x->table_retired, NULL);
+    x->collect = clock_new(x, (method)mcscramble_collect);
+    x->table_size = 0;
+    x->table_chans = 0;
+    x->table_selected = -1;
+    atomic_init(&x->table_index, -1);
+    x->table = NULL;
+    x->table_playing = -1;
+    x->table_rows = (long*)sysmem_newptr((MC_MAX_CHANS + 1) * sizeof(long));
+    x->table_gains = (double*)sysmem_newptr(MC_MAX_CHANS * sizeof(double));
+    for(long j=0; j<=MC_MAX_CHANS; j++) {
+        x->table_rows[j] = j;
+    }
+    for(long j=0; j<MC_MAX_CHANS; j++) {
+        x->table_gains[j] = 1;
+    }
+
+    // seeds from the time, unless @seed is given
+    x->seed = 0;
+    mcscramble_seed_set(x, NULL, 0, NULL);
+    attr_args_process(x, (short)argc, argv);
+
     mcscramble_reset(x);
+    mcscramble_refill(x);
 
     return x;
 }
 
 void mcscramble_free(t_mcscramble* x) {
     dsp_free((t_pxobject*)x);
+    freeobject(x->refill);
+    freeobject(x->collect);
+    critical_free(x->lock);
+    mcroute_buffer_free(&x->routes);
+    mcroute_queue_free(&x->queue);
+    mcroute_matrix_free(&x->triggered);
+    sysmem_freeptr(x->queue_map);
     sysmem_freeptr(x->index_map);
+    sysmem_freeptr(x->keys);
+    sysmem_freeptr(x->order);
+    mcroute_matrix_free(&x->fading);
+    sysmem_freeptr(x->gain_from);
+    sysmem_freeptr(x->gain_to);
+    mcscramble_table_free(x->table);
+    mcscramble_table_free(atomic_load(&x->table_pending));
+    mcscramble_table_free(atomic_load(&x->table_retired));
+    sysmem_freeptr(x->table_rows);
+    sysmem_freeptr(x->table_gains);
 }
 
-/*
- * randlong and mcscramble_bang adapted from:
- * urner - a max object shell
- * jeremy bernstein - jeremy@bootsquad.com
- * Copyright (c) 2015, Cycling '74.
- * All rights reserved.
- * 
- * The software to which this license pertains is the Max SDK that consists of the
- * C language header files and source code examples contained within this archive.
- * 
- * Permission is hereby granted, free of charge, to any person obtaining a copy of
- * this software and associated documentation files (the "Software"), to deal in
- * the Software without restriction, including without limitation the rights to
- * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
- * the Software, and to permit persons to whom the Software is furnished to do so,
- * subject to the following conditions:
- * 
- * The above copyright notice and this permission notice shall be included in all
- * copies or substantial portions of the Software.
- * 
- * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
- * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
- * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
- * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
- * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
- */
+// seeding restarts the sequence, so the same seed gives the same scrambles
+t_max_err mcscramble_seed_set(t_mcscramble* x, void* attr, long argc, t_atom* argv) {
+    if(argc && argv) {
+        x->seed = atom_getlong(argv);
+    }
+    uint64_t state = x->seed;
+    if(state == 0) {
+        state = (uint64_t)systimer_gettime() ^ (uint64_t)(uintptr_t)x;
+    }
+    critical_enter(x->lock);
+    scramble_seed(&x->rng, &state);
+    scramble_seed(&x->queue_rng, &state);
+    critical_exit(x->lock);
+    mcscramble_requeue(x);
+    return MAX_ERR_NONE;
+}
 
-long randlong(long max) {
-    long rand;
-#ifdef WIN_VERSION
-    rand_s(&rand);
-#else
-    rand = random();
-#endif
-    return rand % max;
+t_max_err mcscramble_mode_set(t_mcscramble* x, void* attr, long argc, t_atom* argv) {
+    if(argc && argv) {
+        critical_enter(x->lock);
+        x->mode = CLAMP(atom_getlong(argv), SHUFFLE, LOCAL);
+        critical_exit(x->lock);
+        mcscramble_requeue(x);
+    }
+    return MAX_ERR_NONE;
+}
+
+t_max_err mcscramble_distance_set(t_mcscramble* x, void* attr, long argc, t_atom* argv) {
+    if(argc && argv) {
+        critical_enter(x->lock);
+        x->distance = MAX(atom_getlong(argv), 1);
+        critical_exit(x->lock);
+        mcscramble_requeue(x);
+    }
+    return MAX_ERR_NONE;
+}
+
+// builds the matrix of the inverse of `map`: output j plays the input that
+// was mapped to it
+static void mcscramble_build(t_mcscramble* x, t_mcroute_matrix* m, const int* map) {
+    int* source = x->order;
+    long n = x->numchans;
+    for(long i=0; i<n; i++) {
+        source[map[i]] = (int)i;
+    }
+    mcroute_matrix_begin(m, n);
+    for(long j=0; j<n; j++) {
+        mcroute_matrix_add(m, source[j], 1);
+        mcroute_matrix_end_row(m);
+    }
+}
+
+// hands the index map to the audio thread
+static void mcscramble_publish(t_mcscramble* x) {
+    mcscramble_build(x, mcroute_buffer_back(&x->routes), x->index_map);
+    mcroute_buffer_publish(&x->routes);
+}
+
+// fills `map` with a new scramble drawn from `rng`
+static void mcscramble_generate(t_mcscramble* x, t_scramble_rng* rng, int* map) {
+    long n = x->numchans;
+
+    for(long i=0; i<n; i++) {
+        map[i] = (int)i;
+    }
+
+    switch(x->mode) {
+        case DERANGE:
+            scramble_derange(rng, map, n);
+            break;
+        case CYCLE:
+            scramble_cycle(rng, map, n);
+            break;
+        case LOCAL:
+            scramble_local(rng, map, n, x->distance, x->keys, x->order);
+            break;
+        default:
+            scramble_shuffle(rng, map, n);
+            break;
+    }
+}
+
+// selects table entry `n`, -1 goes back to bang and reset. the audio thread
+// only reads the index, so selecting is the same work for any table
+static void mcscramble_select(t_mcscramble* x, long n) {
+    x->table_selected = n;
+    atomic_store_explicit(&x->table_index, n, memory_order_relaxed);
+}
+
+// sets index map to a new scramble or back to linear, and publishes it.
+// bang and reset also leave the table
+static void mcscramble_update(t_mcscramble* x, enum mcscramble_state state, t_bool deselect) {
+    critical_enter(x->lock);
+    x->state = state;
+    if(state == SCRAMBLED) {
+        mcscramble_generate(x, &x->rng, x->index_map);
+    } else {
+        for(int i=0; i<x->numchans; i++) {
+            x->index_map[i] = i;
+        }
+    }
+    mcscramble_publish(x);
+    if(deselect) {
+        mcscramble_select(x, -1);
+    }
+    critical_exit(x->lock);
 }
 
 // shuffles index map
 void mcscramble_bang(t_mcscramble* x) {
-    x->state = SCRAMBLED;
-    bool* table = (bool*)sysmem_newptrclear(x->numchans * sizeof(bool));
-    for(int i=0; i<x->numchans; i++) {
-        long rand = randlong(x->numchans);
-        if(table[rand] != false) { // NUMBER HAS ALREADY BEEN CHOSEN
-            do {
-                rand = randlong(x->numchans);
-            } while(table[rand] != false);
-        }
-        table[rand] = true; // MARK THIS VALUE AS USED
+    mcscramble_update(x, SCRAMBLED, true);
+}
 
-        x->index_map[i] = rand;
+// prepares scrambles for the trigger inlet until the queue is full
+void mcscramble_refill(t_mcscramble* x) {
+    critical_enter(x->lock);
+    t_mcroute_matrix* m;
+    while((m = mcroute_queue_back(&x->queue))) {
+        mcscramble_generate(x, &x->queue_rng, x->queue_map);
+        mcscramble_build(x, m, x->queue_map);
+        mcroute_queue_push(&x->queue);
     }
+    critical_exit(x->lock);
+}
 
-    sysmem_freeptr(table);
+// throws away the prepared scrambles and builds new ones right away, for
+// when they no longer fit the channels, the mode or the seed
+static void mcscramble_requeue(t_mcscramble* x) {
+    critical_enter(x->lock);
+    mcroute_queue_invalidate(&x->queue, sys_getdspobjdspstate((t_object*)x));
+    critical_exit(x->lock);
+    mcscramble_refill(x);
 }
 
 // sets index map to be linear again
 void mcscramble_reset(t_mcscramble* x) {
-    x->state = LINEAR;
-    for(int i=0; i<x->numchans; i++) {
-        x->index_map[i] = i;
+    mcscramble_update(x, LINEAR, true);
+}
+
+/*
+ * tables of permutations. every entry gives the output of each input,
+ * counted from 1, like the index map. the whole table is checked and
+ * inverted when it is loaded, so selecting an entry doesn't cost anything
+ */
+
+static t_mcscramble_table* mcscramble_table_new(long chans, long size) {
+    t_mcscramble_table* t = (t_mcscramble_table*)sysmem_newptr(sizeof(t_mcscramble_table));
+    t->chans = chans;
+    t->size = size;
+    t->sources = (int*)sysmem_newptr(chans * size * sizeof(int));
+    if(!t->sources) {
+        sysmem_freeptr(t);
+        return NULL;
+    }
+    for(long i=0; i<chans*size; i++) {
+        t->sources[i] = -1;
+    }
+    return t;
+}
+
+static void mcscramble_table_free(t_mcscramble_table* t) {
+    if(t) {
+        sysmem_freeptr(t->sources);
+        sysmem_freeptr(t);
+    }
+}
+
+// input i of entry e goes to `output`. every output may only be used once
+static t_bool mcscramble_table_set(t_mcscramble* x, t_mcscramble_table* t, long e, long i, long output) {
+    if(output < 1 || output > t->chans) {
+        object_error((t_object*)x, "entry %ld: channel %ld doesn't exist", e, output);
+        return false;
+    }
+    int* source = t->sources + e * t->chans + output - 1;
+    if(*source >= 0) {
+        object_error((t_object*)x, "entry %ld: channel %ld is used twice", e, output);
+        return false;
+    }
+    *source = (int)i;
+    return true;
+}
+
+// fills a table from atoms, `chans` per entry
+static t_mcscramble_table* mcscramble_table_atoms(t_mcscramble* x, long chans, long argc, t_atom* argv) {
+    if(argc % chans) {
+        object_error((t_object*)x, "the table needs %ld channels per entry, got %ld values", chans, argc);
+        return NULL;
+    }
+    t_mcscramble_table* t = mcscramble_table_new(chans, argc / chans);
+    if(!t) {
+        object_error((t_object*)x, "out of memory");
+        return NULL;
+    }
+    for(long k=0; k<argc; k++) {
+        if(!mcscramble_table_set(x, t, k / chans, k % chans, atom_getlong(argv + k))) {
+            mcscramble_table_free(t);
+            return NULL;
+        }
+    }
+    return t;
+}
+
+// frees the table the audio thread gave back
+void mcscramble_collect(t_mcscramble* x) {
+    mcscramble_table_free(atomic_exchange(&x->table_retired, NULL));
+}
+
+// hands a new table to the audio thread. the selected entry stays selected,
+// if it exists in the new table
+static void mcscramble_table_publish(t_mcscramble* x, t_mcscramble_table* t) {
+    critical_enter(x->lock);
+    mcscramble_collect(x);
+    mcscramble_table_free(atomic_exchange(&x->table_pending, t));
+    x->table_size = t->size;
+    x->table_chans = t->chans;
+    if(x->table_selected >= t->size) {
+        mcscramble_select(x, -1);
+    }
+    critical_exit(x->lock);
+    object_post((t_object*)x, "table: %ld entries of %ld channels", t->size, t->chans);
+}
+
+// table <output of input 1> <output of input 2> ..., one entry after another,
+// as many channels per entry as the input has
+void mcscramble_table(t_mcscramble* x, t_symbol* s, long argc, t_atom* argv) {
+    if(!argc) {
+        object_error((t_object*)x, "table: no entries");
+        return;
+    }
+    t_mcscramble_table* t = mcscramble_table_atoms(x, x->numchans, argc, argv);
+    if(t) {
+        mcscramble_table_publish(x, t);
     }
 }
 
+// the key "table" of a dictionary holds an array of entries, each an array
+// of channels. a flat array of channels works as for the table message
+// the atoms of an array in a dictionary, false if `a` holds something else,
+// e.g. a dictionary
+static t_bool mcscramble_array_atoms(const t_atom* a, long* argc, t_atom** argv) {
+    if(atom_gettype(a) != A_OBJ || object_classname(atom_getobj(a)) != gensym("atomarray")) {
+        return false;
+    }
+    atomarray_getatoms((t_atomarray*)atom_getobj(a), argc, argv);
+    return true;
+}
+
+void mcscramble_dictionary(t_mcscramble* x, t_symbol* name) {
+    t_dictionary* d = dictobj_findregistered_retain(name);
+    if(!d) {
+        object_error((t_object*)x, "dictionary %s doesn't exist", name->s_name);
+        return;
+    }
+
+    long argc = 0;
+    t_atom* argv = NULL;
+    t_mcscramble_table* t = NULL;
+    if(dictionary_getatoms(d, gensym("table"), &argc, &argv) != MAX_ERR_NONE || !argc) {
+        object_error((t_object*)x, "dictionary %s has no key table", name->s_name);
+    } else if(atom_gettype(argv) != A_OBJ) {
+        t = mcscramble_table_atoms(x, x->numchans, argc, argv);
+    } else {
+        long chans = 0;
+        t_atom* entry = NULL;
+        if(!mcscramble_array_atoms(argv, &chans, &entry)) {
+            object_error((t_object*)x, "entry 0: not an array of channels");
+        } else if(chans < 1 || chans > MC_MAX_CHANS) {
+            object_error((t_object*)x, "entries have to have between 1 and %d channels", MC_MAX_CHANS);
+        } else if((t = mcscramble_table_new(chans, argc))) {
+            for(long e=0; e<argc && t; e++) {
+                long n = 0;
+                if(!mcscramble_array_atoms(argv + e, &n, &entry)) {
+                    object_error((t_object*)x, "entry %ld: not an array of channels", e);
+                    mcscramble_table_free(t);
+                    t = NULL;
+                    break;
+                }
+                if(n != chans) {
+                    object_error((t_object*)x, "entry %ld: expected %ld channels", e, chans);
+                    mcscramble_table_free(t);
+                    t = NULL;
+                    break;
+                }
+                for(long i=0; i<chans; i++) {
+                    if(!mcscramble_table_set(x, t, e, i, atom_getlong(entry + i))) {
+                        mcscramble_table_free(t);
+                        t = NULL;
+                        break;
+                    }
+                }
+            }
+        } else {
+            object_error((t_object*)x, "out of memory");
+        }
+    }
+    dictobj_release(d);
+
+    if(t) {
+        mcscramble_table_publish(x, t);
+    }
+}
+
+// buffer <name> [channels per entry]: the first channel of the buffer~ holds
+// the entries one after another, as many samples per entry as the input has
+// channels unless given
+void mcscramble_buffer(t_mcscramble* x, t_symbol* s, long argc, t_atom* argv) {
+    if(!argc || atom_gettype(argv) != A_SYM) {
+        object_error((t_object*)x, "buffer: expected the name of a buffer~");
+        return;
+    }
+    t_symbol* name = atom_getsym(argv);
+    long chans = argc > 1 ? atom_getlong(argv + 1) : x->numchans;
+    if(chans < 1 || chans > MC_MAX_CHANS) {
+        object_error((t_object*)x, "entries have to have between 1 and %d channels", MC_MAX_CHANS);
+        return;
+    }
+
+    t_buffer_ref* ref = buffer_ref_new((t_object*)x, name);
+    t_buffer_obj* b = buffer_ref_getobject(ref);
+    if(!b) {
+        object_error((t_object*)x, "buffer~ %s doesn't exist", name->s_name);
+        object_free(ref);
+        return;
+    }
+
+    long frames = buffer_getframecount(b);
+    long stride = buffer_getchannelcount(b);
+    t_mcscramble_table* t = NULL;
+    float* samples = buffer_locksamples(b);
+    if(!samples) {
+        object_error((t_object*)x, "buffer~ %s can't be read", name->s_name);
+    } else if(!frames || frames % chans) {
+        object_error((t_object*)x, "buffer~ %s needs %ld samples per entry, got %ld samples", name->s_name, chans, frames);
+    } else if(!(t = mcscramble_table_new(chans, frames / chans))) {
+        object_error((t_object*)x, "out of memory");
+    } else {
+        for(long k=0; k<frames; k++) {
+            if(!mcscramble_table_set(x, t, k / chans, k % chans, lround(samples[k * stride]))) {
+                mcscramble_table_free(t);
+                t = NULL;
+                break;
+            }
+        }
+    }
+    if(samples) {
+        buffer_unlocksamples(b);
+    }
+    object_free(ref);
+
+    if(t) {
+        mcscramble_table_publish(x, t);
+    }
+}
+
+// selects entry n of the table, counted from 0. call with the lock held
+static void mcscramble_entry(t_mcscramble* x, long n) {
+    if(!x->table_size) {
+        object_error((t_object*)x, "no table loaded");
+    } else if(n < 0 || n >= x->table_size) {
+        object_error((t_object*)x, "the table has entries 0 to %ld", x->table_size - 1);
+    } else {
+        if(x->table_chans != x->numchans) {
+            object_warn((t_object*)x, "the table has %ld channels, the input %ld", x->table_chans, x->numchans);
+        }
+        mcscramble_select(x, n);
+    }
+}
+
+void mcscramble_int(t_mcscramble* x, long n) {
+    critical_enter(x->lock);
+    mcscramble_entry(x, n);
+    critical_exit(x->lock);
+}
+
+// steps through the table and wraps around at the ends. the first step
+// after bang or reset selects the first or last entry
+static void mcscramble_step(t_mcscramble* x, long step) {
+    critical_enter(x->lock);
+    long size = x->table_size;
+    long n = x->table_selected;
+    if(n < 0) {
+        n = step > 0 ? 0 : size - 1;
+    } else if(size) {
+        n = ((n + step) % size + size) % size;
+    }
+    mcscramble_entry(x, n);
+    critical_exit(x->lock);
+}
+
+void mcscramble_next_entry(t_mcscramble* x) {
+    mcscramble_step(x, 1);
+}
+
+void mcscramble_prev_entry(t_mcscramble* x) {
+    mcscramble_step(x, -1);
+}
+
 long mcscramble_multichanneloutputs(t_mcscramble* x, long index) {
     return x->numchans;
 }
 
 long mcscramble_inputchanged(t_mcscramble* x, long index, long count) {
-    if(count != x->numchans) {
+    // only the left inlet decides the number of channels
+    if(index == 0 && count != x->numchans) {
         x->numchans = CLAMP(count, 1, MC_MAX_CHANS);
 
-        sysmem_freeptr(x->index_map);
-        x->index_map = (int*)sysmem_newptrclear(x->numchans * sizeof(int));
+        // the maps have room for MC_MAX_CHANS, so only a new one is published.
+        // a selected table entry stays selected
+        mcscramble_update(x, x->state, false);
 
-        if(x->state == LINEAR) {
-            mcscramble_reset(x);
-        } else {
-            mcscramble_bang(x);
-        }
+        // the prepared scrambles are for the old channels, new ones are built
+        // right away so the next trigger already has one
+        mcscramble_requeue(x);
 
         return true;
     }
@@ -166,23 +663,166 @@ long mcscramble_inputchanged(t_mcscramble* x, long index, long count) {
     return false;
 }
 
+// equal power gains for the next `n` samples of the running fade, computed
+// once per block for all channels
+static void mcscramble_fade_gains(t_mcscramble* x, long n) {
+    double scale = (M_PI / 2) / x->fade_length;
+    for(long k=0; k<n; k++) {
+        double angle = MIN(x->fade_pos + k + 1, x->fade_length) * scale;
+        x->gain_from[k] = cos(angle);
+        x->gain_to[k] = sin(angle);
+    }
+}
+
+// audio thread: points the table view at entry e
+static t_mcroute_matrix* mcscramble_view(t_mcscramble* x, long e) {
+    t_mcroute_matrix* v = &x->table_view;
+    long chans = x->table->chans;
+    v->numins = chans;
+    v->numouts = chans;
+    v->kind = MCROUTE_PERMUTATION;
+    v->rows = x->table_rows;
+    v->inputs = x->table->sources + e * chans;
+    v->gains = x->table_gains;
+    v->size = chans;
+    v->capacity = chans;
+    return v;
+}
+
+// audio thread: switches to a new scramble or table entry, if there is one.
+// while a table entry is selected, bang and reset wait
+static t_mcroute_matrix* mcscramble_switch(t_mcscramble* x, t_mcroute_matrix* m) {
+    // a new table is only taken once the one before was freed
+    t_mcscramble_table* retired = NULL;
+    t_bool reselect = false;
+    if(!atomic_load_explicit(&x->table_retired, memory_order_acquire)) {
+        t_mcscramble_table* t = atomic_exchange_explicit(&x->table_pending, NULL, memory_order_acq_rel);
+        if(t) {
+            retired = x->table;
+            x->table = t;
+            // the entry that is playing may be in the old table
+            reselect = m == &x->table_view;
+        }
+    }
+
+    long index = atomic_load_explicit(&x->table_index, memory_order_relaxed);
+    if(!x->table || index >= x->table->size) {
+        index = -1;
+    }
+
+    t_bool entry = index >= 0 && (index != x->table_playing || reselect);
+    t_bool linear = index < 0 && (x->table_playing >= 0 || reselect || mcroute_buffer_fresh(&x->routes));
+    x->table_playing = index;
+
+    if(entry || linear) {
+        // the old matrix goes back to the main thread, the fade needs a copy
+        t_bool fade = x->fade > 0 && !reselect && mcroute_matrix_copy(&x->fading, m);
+        m = entry ? mcscramble_view(x, index) : mcroute_buffer_take(&x->routes);
+
+        // a new channel count can't be faded from
+        x->fade_pos = 0;
+        x->fade_length = 0;
+        if(fade && x->fading.numouts == m->numouts) {
+            x->fade_length = (long)(x->fade * x->samplerate / 1000.);
+        }
+    }
+
+    if(retired) {
+        atomic_store_explicit(&x->table_retired, retired, memory_order_release);
+        clock_delay(x->collect, 0);
+    }
+
+    return m;
+}
+
 void mcscramble_perform(t_mcscramble* x, t_object* dsp64, double** ins, long numins, double** outs, long numouts, long sampleframes, long flags, void* userparam) {
-    long numchans = MIN(numins, numouts);
-    for(int i=0; i<numchans; i++) {
-        int chan = x->index_map[i];
-        double* in = ins[i];
-        double* out = outs[chan];
-        sysmem_copyptr(in, out, sizeof(double) * sampleframes);
+    // a new matrix is only taken once the running fade is done. the exchange
+    // happens once per block, so a permutation is always played as a whole
+    t_mcroute_matrix* m = x->playing;
+    if(x->fade_pos >= x->fade_length) {
+        m = mcscramble_switch(x, m);
     }
+
+    x->playing = m;
+
+    // the trigger signal comes after the channels of the left inlet
+    long inchans = MIN(x->numchans, numins - 1);
+    long numchans = MIN(inchans, numouts);
+    const double* trigger = ins[inchans];
+    if(m->numouts != numchans) {
+        // the channel count changed and the matching map isn't there yet.
+        // triggers still take the scrambles for the new count
+        for(int i=0; i<numchans; i++) {
+            sysmem_copyptr(ins[i], outs[i], sizeof(double) * sampleframes);
+        }
+        if(x->trigger_connected && mcroute_follow_triggered(&x->queue, &x->triggered, &x->playing, &x->trigger_last, trigger, sampleframes)) {
+            clock_delay(x->refill, 0);
+        }
+        return;
+    }
+
+    long offset = 0;
+    long taken = 0;
+    if(x->fade_pos < x->fade_length && sampleframes <= x->block_size) {
+        // a trigger with a scramble to switch to ends the fade at its sample
+        long end = sampleframes;
+        if(x->trigger_connected) {
+            taken = mcroute_queue_drop_stale(&x->queue);
+            if(mcroute_queue_front(&x->queue)) {
+                end = mcroute_trigger_edge(trigger, x->trigger_last, 0, sampleframes);
+            }
+        }
+
+        mcscramble_fade_gains(x, end);
+        mcroute_crossfade(&x->fading, m, ins, inchans, outs, numouts, x->gain_from, x->gain_to, 0, end);
+        x->fade_pos = MIN(x->fade_pos + end, x->fade_length);
+        if(end == sampleframes) {
+            if(x->trigger_connected) {
+                x->trigger_last = trigger[sampleframes - 1];
+            }
+            if(taken) {
+                clock_delay(x->refill, 0);
+            }
+            return;
+        }
+        x->fade_pos = x->fade_length;
+        offset = end;
+    }
+
+    if(x->trigger_connected) {
+        // switches at the trigger sample, to a scramble that is already built
+        taken += mcroute_process_triggered(&x->queue, &x->triggered, &x->playing, &x->trigger_last, trigger, ins, inchans, outs, numouts, offset, sampleframes);
+        if(taken) {
+            clock_delay(x->refill, 0);
+        }
+        return;
+    }
+
+    mcroute_process(m, ins, inchans, outs, numouts, sampleframes);
 }
 
 void mcscramble_dsp64(t_mcscramble* x, t_object* dsp64, short* count, double samplerate, long maxvectorsize, long flags) {
+    x->samplerate = samplerate;
+
+    // fade gains for one block
+    if(maxvectorsize > x->block_size) {
+        sysmem_freeptr(x->gain_from);
+        sysmem_freeptr(x->gain_to);
+        x->gain_from = (double*)sysmem_newptr(maxvectorsize * sizeof(double));
+        x->gain_to = (double*)sysmem_newptr(maxvectorsize * sizeof(double));
+        x->block_size = maxvectorsize;
+    }
+
+    x->trigger_connected = count[1];
+
     dsp_add64(dsp64, (t_object*)x, (t_perfroutine64)mcscramble_perform, 0, NULL);
 }
 
 void mcscramble_assist(t_mcscramble* x, void* b, long m, long a, char* s) {
-    if(m == 1) {
-        strcpy(s, "(multi-channel signal) Input");
+    if(m == 1 && a == 1) {
+        strcpy(s, "(signal) Trigger, switches to the next scramble");
+    } else if(m == 1) {
+        strcpy(s, "(multi-channel signal) Input, bang, (int) Table Entry");
     } else if(m == 2) {
         sprintf(s, "(multi-channel signal) Input, rotated");
     }
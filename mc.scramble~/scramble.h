@@ -0,0 +1,159 @@
+/*
+ * scramble.h - random permutations for mc.scramble~
+ * Copyright (C) 2024-2025 Manolo Müller
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License
+ * as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * the generators only depend on the random state and the map they fill, not
+ * on max, so they can be tested on their own (see test/).
+ * every map starts out as the identity 0, 1, 2, ... and is scrambled in place.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * xoshiro256** by david blackman and sebastiano vigna, public domain
+ * https://prng.di.unimi.it
+ * seeded with splitmix64, as recommended by the authors
+ */
+
+typedef struct _scramble_rng {
+    uint64_t s[4];
+} t_scramble_rng;
+
+static inline uint64_t scramble_rotl(uint64_t v, int k) {
+    return (v << k) | (v >> (64 - k));
+}
+
+static inline uint64_t scramble_splitmix64(uint64_t* state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// `state` is advanced, so several generators can be seeded from it in turn
+static inline void scramble_seed(t_scramble_rng* rng, uint64_t* state) {
+    for(int i=0; i<4; i++) {
+        rng->s[i] = scramble_splitmix64(state);
+    }
+}
+
+static inline uint64_t scramble_next(t_scramble_rng* rng) {
+    uint64_t* s = rng->s;
+    uint64_t result = scramble_rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = scramble_rotl(s[3], 45);
+    return result;
+}
+
+// uniform in [0, range) without modulo bias (lemire's multiply and shift).
+// range is at most MC_MAX_CHANS, so it almost never has to draw again
+static inline uint32_t scramble_below(t_scramble_rng* rng, uint32_t range) {
+    uint64_t m = (scramble_next(rng) >> 32) * range;
+    uint32_t low = (uint32_t)m;
+    if(low < range) {
+        uint32_t threshold = -range % range;
+        while(low < threshold) {
+            m = (scramble_next(rng) >> 32) * range;
+            low = (uint32_t)m;
+        }
+    }
+    return (uint32_t)(m >> 32);
+}
+
+// uniform in [0, 1)
+static inline double scramble_uniform(t_scramble_rng* rng) {
+    return (scramble_next(rng) >> 11) * 0x1.0p-53;
+}
+
+// fisher-yates, every permutation is equally likely
+static inline void scramble_shuffle(t_scramble_rng* rng, int* map, long n) {
+    for(long i=n-1; i>0; i--) {
+        long j = scramble_below(rng, (uint32_t)i + 1);
+        int tmp = map[i];
+        map[i] = map[j];
+        map[j] = tmp;
+    }
+}
+
+// no channel stays where it is. fisher-yates from the top fixes one entry per
+// step, so a fixed point can be detected (and the shuffle restarted) as soon
+// as it appears. about e attempts are needed, every derangement is equally likely
+static inline void scramble_derange(t_scramble_rng* rng, int* map, long n) {
+    if(n < 2) {
+        return;
+    }
+    long i;
+    do {
+        for(long j=0; j<n; j++) {
+            map[j] = (int)j;
+        }
+        for(i=n-1; i>0; i--) {
+            long j = scramble_below(rng, (uint32_t)i + 1);
+            int tmp = map[i];
+            map[i] = map[j];
+            map[j] = tmp;
+            if(map[i] == i) {
+                break;
+            }
+        }
+    } while(i > 0 || map[0] == 0);
+}
+
+// sattolo's algorithm: all channels form a single cycle
+static inline void scramble_cycle(t_scramble_rng* rng, int* map, long n) {
+    for(long i=n-1; i>0; i--) {
+        long j = scramble_below(rng, (uint32_t)i);
+        int tmp = map[i];
+        map[i] = map[j];
+        map[j] = tmp;
+    }
+}
+
+// every channel moves by at most `distance`. each channel gets a key of its
+// position plus a random offset below `distance` + 1, sorting by key keeps
+// all channels within reach. the keys are almost sorted already, so
+// insertion sort only needs O(n * distance). `keys` and `order` are scratch
+// space for n entries
+static inline void scramble_local(t_scramble_rng* rng, int* map, long n, long distance, double* keys, int* order) {
+    double width = (double)distance + 1;
+    for(long i=0; i<n; i++) {
+        keys[i] = i + scramble_uniform(rng) * width;
+        order[i] = (int)i;
+    }
+    for(long i=1; i<n; i++) {
+        double key = keys[i];
+        int channel = order[i];
+        long j = i - 1;
+        for(; j >= 0 && keys[j] > key; j--) {
+            keys[j + 1] = keys[j];
+            order[j + 1] = order[j];
+        }
+        keys[j + 1] = key;
+        order[j + 1] = channel;
+    }
+    // output i plays the channel that was sorted into place i
+    for(long i=0; i<n; i++) {
+        map[order[i]] = (int)i;
+    }
+}
@@ -0,0 +1,280 @@
+/*
+ * scramble_test.c - checks the generators of mc.scramble~
+ * Copyright (C) 2024-2025 Manolo Müller
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License
+ * as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * every mode is checked for producing valid permutations with its own
+ * property (no fixed points, a single cycle, bounded displacement), and the
+ * uniform modes with a chi-square test over all permutations of 5 channels.
+ * the seeds are fixed, so the results are the same on every run. the time
+ * per scramble of 1024 channels is printed as well.
+ */
+
+#include "scramble.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_CHANS 1024
+
+enum { SHUFFLE=0, DERANGE, CYCLE, LOCAL, N_MODES };
+static const char* s_names[N_MODES] = {"shuffle", "derange", "cycle", "local"};
+
+static double s_keys[MAX_CHANS];
+static int s_order[MAX_CHANS];
+static int s_failed = 0;
+
+static void generate(t_scramble_rng* rng, int mode, int* map, long n, long distance) {
+    for(long i=0; i<n; i++) {
+        map[i] = (int)i;
+    }
+    switch(mode) {
+        case DERANGE:
+            scramble_derange(rng, map, n);
+            break;
+        case CYCLE:
+            scramble_cycle(rng, map, n);
+            break;
+        case LOCAL:
+            scramble_local(rng, map, n, distance, s_keys, s_order);
+            break;
+        default:
+            scramble_shuffle(rng, map, n);
+            break;
+    }
+}
+
+static void fail(const char* what, int mode, long n, long distance) {
+    if(s_failed < 20) {
+        printf("FAIL %s: %s with %ld channels, distance %ld\n", s_names[mode], what, n, distance);
+    }
+    s_failed++;
+}
+
+static void check(int mode, const int* map, long n, long distance) {
+    char seen[MAX_CHANS];
+    memset(seen, 0, n);
+    for(long i=0; i<n; i++) {
+        if(map[i] < 0 || map[i] >= n || seen[map[i]]) {
+            fail("not a permutation", mode, n, distance);
+            return;
+        }
+        seen[map[i]] = 1;
+    }
+
+    if(mode == DERANGE && n > 1) {
+        for(long i=0; i<n; i++) {
+            if(map[i] == i) {
+                fail("fixed point", mode, n, distance);
+                return;
+            }
+        }
+    }
+    if(mode == CYCLE) {
+        long length = 0;
+        long i = 0;
+        do {
+            i = map[i];
+            length++;
+        } while(i != 0 && length <= n);
+        if(length != n) {
+            fail("more than one cycle", mode, n, distance);
+        }
+    }
+    if(mode == LOCAL) {
+        for(long i=0; i<n; i++) {
+            long d = map[i] - i;
+            if(d > distance || -d > distance) {
+                fail("moved too far", mode, n, distance);
+                return;
+            }
+        }
+    }
+}
+
+static void test_properties(void) {
+    t_scramble_rng rng;
+    uint64_t state = 1;
+    scramble_seed(&rng, &state);
+    int map[MAX_CHANS];
+    long sizes[] = {1, 2, 3, 4, 5, 7, 8, 16, 31, 64, 100, 1000, 1024};
+    long distances[] = {1, 2, 3, 10, 1024};
+
+    for(int mode=0; mode<N_MODES; mode++) {
+        for(size_t s=0; s<sizeof(sizes) / sizeof(long); s++) {
+            long n = sizes[s];
+            long repeats = n > 100 ? 50 : 2000;
+            for(size_t d=0; d<(mode == LOCAL ? sizeof(distances) / sizeof(long) : 1); d++) {
+                for(long r=0; r<repeats; r++) {
+                    generate(&rng, mode, map, n, distances[d]);
+                    check(mode, map, n, distances[d]);
+                }
+            }
+        }
+    }
+}
+
+// index of a permutation of n < 13 channels in lexicographic order
+static long rank(const int* map, long n) {
+    long r = 0;
+    for(long i=0; i<n; i++) {
+        long smaller = 0;
+        for(long j=i+1; j<n; j++) {
+            smaller += map[j] < map[i];
+        }
+        r = r * (n - i) + smaller;
+    }
+    return r;
+}
+
+// which permutations the mode can produce at all
+static int possible(int mode, const int* map, long n) {
+    if(mode == DERANGE) {
+        for(long i=0; i<n; i++) {
+            if(map[i] == i) {
+                return 0;
+            }
+        }
+    }
+    if(mode == CYCLE) {
+        long length = 0;
+        long i = 0;
+        do {
+            i = map[i];
+            length++;
+        } while(i != 0);
+        return length == n;
+    }
+    return 1;
+}
+
+// every permutation the mode can produce has to come up equally often.
+// the critical values are for p = 0.001, so a correct generator fails
+// about once in a thousand seeds, and these seeds are fixed
+static void test_uniformity(int mode, uint64_t seed) {
+    enum { N = 5, PERMUTATIONS = 120, DRAWS = 1200000 };
+    // chi-square at p = 0.001 for 119, 43 (44 derangements) and 23 (24 cycles)
+    // degrees of freedom
+    const double critical[N_MODES] = {166.6, 77.4, 49.7, 0};
+
+    t_scramble_rng rng;
+    scramble_seed(&rng, &seed);
+    long counts[PERMUTATIONS] = {0};
+    int map[N];
+    for(long r=0; r<DRAWS; r++) {
+        generate(&rng, mode, map, N, 0);
+        counts[rank(map, N)]++;
+    }
+
+    // enumerates the permutations by unranking every index
+    long reachable = 0;
+    double chi = 0;
+    long impossible = 0;
+    for(long p=0; p<PERMUTATIONS; p++) {
+        int perm[N];
+        int used[N] = {0};
+        long r = p;
+        long radix = PERMUTATIONS;
+        for(long i=0; i<N; i++) {
+            radix /= N - i;
+            long k = r / radix;
+            r %= radix;
+            for(long c=0; c<N; c++) {
+                if(!used[c] && k-- == 0) {
+                    perm[i] = (int)c;
+                    used[c] = 1;
+                    break;
+                }
+            }
+        }
+        if(possible(mode, perm, N)) {
+            reachable++;
+        } else {
+            impossible += counts[p];
+            counts[p] = -1;
+        }
+    }
+    double expected = (double)DRAWS / reachable;
+    for(long p=0; p<PERMUTATIONS; p++) {
+        if(counts[p] >= 0) {
+            chi += (counts[p] - expected) * (counts[p] - expected) / expected;
+        }
+    }
+
+    printf("%s: %ld permutations of %d channels, chi-square %.1f (critical %.1f)\n",
+           s_names[mode], reachable, N, chi, critical[mode]);
+    if(impossible) {
+        fail("impossible permutation", mode, N, 0);
+    }
+    if(chi > critical[mode]) {
+        fail("not uniform", mode, N, 0);
+    }
+}
+
+// with @mode local, every displacement within reach has to occur
+static void test_local_reach(void) {
+    t_scramble_rng rng;
+    uint64_t state = 4;
+    scramble_seed(&rng, &state);
+    enum { N = 64, DISTANCE = 3 };
+    long seen[2 * DISTANCE + 1] = {0};
+    int map[N];
+    for(long r=0; r<10000; r++) {
+        generate(&rng, LOCAL, map, N, DISTANCE);
+        for(long i=DISTANCE; i<N-DISTANCE; i++) {
+            seen[map[i] - i + DISTANCE]++;
+        }
+    }
+    for(long d=0; d<=2*DISTANCE; d++) {
+        if(!seen[d]) {
+            fail("displacement never happens", LOCAL, N, DISTANCE);
+        }
+    }
+}
+
+static void bench(void) {
+    t_scramble_rng rng;
+    uint64_t state = 5;
+    scramble_seed(&rng, &state);
+    int map[MAX_CHANS];
+    enum { REPEATS = 2000 };
+    for(int mode=0; mode<N_MODES; mode++) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(long r=0; r<REPEATS; r++) {
+            generate(&rng, mode, map, MAX_CHANS, 2);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double us = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / 1e3 / REPEATS;
+        printf("%s: %.1f us per scramble of %d channels\n", s_names[mode], us, MAX_CHANS);
+    }
+}
+
+int main(void) {
+    test_properties();
+    test_uniformity(SHUFFLE, 2);
+    test_uniformity(DERANGE, 3);
+    test_uniformity(CYCLE, 4);
+    test_local_reach();
+    bench();
+
+    if(s_failed) {
+        printf("%d checks failed\n", s_failed);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
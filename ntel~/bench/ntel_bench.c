@@ -0,0 +1,195 @@
+/*
+ *  ntel_bench.c
+ *  per-sample cost of ntel~'s block passes with many instances running
+ *
+ * Copyright (C) 2023-2025 Manolo Müller
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License
+ * as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * compares the two passes in ntel_scan.h against the loop they replaced,
+ * which called fmod and branched on every sample. every instance gets its
+ * own phasor and buffers, so the caches see what a patch with many ntel~s
+ * would do. the edges found by both are checked to be the same, and the
+ * time @lookahead predicts for an edge is checked against where it is found.
+ *
+ */
+
+#include "ntel_scan.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define INSTANCES 256
+#define SECONDS 10      // of audio per instance at 48kHz
+#define SAMPLERATE 48000
+
+typedef struct _instance {
+    double* in;
+    double* scaled;
+    long* events;
+    double phase;
+    double increment;
+    double divider;
+    double history;
+    long edges;
+} t_instance;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void fill(t_instance* x, long n) {
+    for(long i=0; i<n; i++) {
+        x->phase += x->increment;
+        x->phase -= x->phase >= 1;
+        x->in[i] = x->phase;
+    }
+}
+
+// what the perform routine did per sample before
+static void reference(t_instance* x, long n) {
+    for(long i=0; i<n; i++) {
+        double p = fmod(fabs(x->in[i] * x->divider), 1);
+        if(p - x->history <= 0) {
+            x->edges++;
+        }
+        x->history = p;
+    }
+}
+
+static void passes(t_instance* x, long n) {
+    ntel_scale(x->in, x->scaled, x->divider, n);
+    x->edges += ntel_scan(x->scaled, x->history, x->events, n);
+    x->history = x->scaled[n - 1];
+}
+
+static void init(t_instance* instances, long n) {
+    srand(1);
+    for(long j=0; j<INSTANCES; j++) {
+        t_instance* x = instances + j;
+        x->in = malloc(n * sizeof(double));
+        x->scaled = malloc(n * sizeof(double));
+        x->events = malloc(n * sizeof(long));
+        x->phase = 0;
+        // 0.1Hz to 10Hz, up to 16 steps
+        x->increment = (0.1 + rand() % 1000 / 100.0) / SAMPLERATE;
+        x->divider = 1 + rand() % 16;
+        x->history = 0;
+        x->edges = 0;
+    }
+}
+
+static void release(t_instance* instances) {
+    for(long j=0; j<INSTANCES; j++) {
+        free(instances[j].in);
+        free(instances[j].scaled);
+        free(instances[j].events);
+    }
+}
+
+// returns nanoseconds per sample, only the pass itself is timed
+static double run(void (*pass)(t_instance*, long), long n, long* edges) {
+    t_instance instances[INSTANCES];
+    init(instances, n);
+
+    long blocks = SECONDS * SAMPLERATE / n;
+    double elapsed = 0;
+    for(long b=0; b<blocks; b++) {
+        for(long j=0; j<INSTANCES; j++) {
+            fill(instances + j, n);
+        }
+        double start = now();
+        for(long j=0; j<INSTANCES; j++) {
+            pass(instances + j, n);
+        }
+        elapsed += now() - start;
+    }
+
+    *edges = 0;
+    for(long j=0; j<INSTANCES; j++) {
+        *edges += instances[j].edges;
+    }
+    release(instances);
+    return elapsed * 1e9 / ((double)blocks * n * INSTANCES);
+}
+
+// predicts the next edge from every block the way ntel~ does and checks it
+// against the edge found in the next block: the wrap lies between the
+// sample before the edge and the edge, so the latency getstats reports for
+// a predicted bang is between -1 and 0 samples. returns the number of misses
+static long check_prediction(long n, long* predictions) {
+    t_instance instances[INSTANCES];
+    init(instances, n);
+
+    long misses = 0;
+    *predictions = 0;
+    long blocks = SAMPLERATE / n;
+    for(long j=0; j<INSTANCES; j++) {
+        t_instance* x = instances + j;
+        double delay = 2 * n;
+        for(long b=0; b<blocks; b++) {
+            fill(x, n);
+            ntel_scale(x->in, x->scaled, x->divider, n);
+            long n_events = ntel_scan(x->scaled, x->history, x->events, n);
+            x->history = x->scaled[n - 1];
+
+            if(delay < 2 * n - 1) {
+                // the prediction made from the previous block
+                double predicted = delay - n;
+                (*predictions)++;
+                if(!n_events || predicted <= x->events[0] - 1 || predicted > x->events[0]) {
+                    misses++;
+                }
+            }
+
+            double rise = x->in[n - 1] - x->in[0];
+            if(rise < 0) {
+                rise += 1;
+            }
+            double slope = rise * x->divider / (n - 1);
+            delay = slope * n < 1 ? ntel_predict_delay(x->scaled[n - 1], slope, n) : 2 * n;
+        }
+    }
+
+    release(instances);
+    return misses;
+}
+
+int main(void) {
+    long sizes[] = {64, 512};
+    int failed = 0;
+
+    printf("%d instances, %ds of audio each\n", INSTANCES, SECONDS);
+    for(int s=0; s<2; s++) {
+        long n = sizes[s];
+        long reference_edges, edges;
+        double before = run(reference, n, &reference_edges);
+        double after = run(passes, n, &edges);
+        printf("vector size %4ld: fmod %.3f ns/sample, passes %.3f ns/sample (%.1fx)\n",
+               n, before, after, before / after);
+        if(edges != reference_edges) {
+            printf("  edges differ: %ld instead of %ld\n", edges, reference_edges);
+            failed = 1;
+        }
+        long predictions;
+        long misses = check_prediction(n, &predictions);
+        printf("  %ld of %ld predicted edges off by a sample or more\n", misses, predictions);
+        failed |= misses > 0;
+    }
+    return failed;
+}
@@ -0,0 +1,64 @@
+/*
+ *  ntel_scan.h
+ *  the per-block passes of ntel~ over its input phase
+ *
+ * Copyright (C) 2023-2025 Manolo Müller
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License
+ * as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * these don't depend on max, so the benchmark in bench/ runs exactly the
+ * code the external runs.
+ *
+ */
+
+#pragma once
+
+#include <math.h>
+
+// scale frequency of input phase by `divider`
+// this will make a phasor at 1Hz go `divider` times faster
+// x - floor(x) is the same as fmod(x, 1) for positive x, but has no
+// branches, so the compiler can vectorize this loop (with
+// -fno-trapping-math on gcc, see CMakeLists.txt)
+static inline void ntel_scale(const double* in, double* scaled, double divider, long n) {
+    for(long i=0; i<n; i++) {
+        double phase = fabs(in[i] * divider);
+        scaled[i] = phase - floor(phase);
+    }
+}
+
+// edges are rare, so only collect the samples where the scaled phase
+// didn't rise (falling edge or stalled phasor) and look at those later.
+// the index is always written and only kept if the condition holds.
+// `events` needs room for n entries, returns how many were kept
+static inline long ntel_scan(const double* scaled, double history, long* events, long n) {
+    long n_events = 0;
+    events[n_events] = 0;
+    n_events += scaled[0] <= history;
+    for(long i=1; i<n; i++) {
+        events[n_events] = i;
+        n_events += scaled[i] <= scaled[i - 1];
+    }
+    return n_events;
+}
+
+// @lookahead: how many samples after the first sample of the block the
+// scaled phase wraps, if it keeps rising by `slope` per sample from `last`,
+// its value at the block's last sample. detected edges are timestamped from
+// the start of the block too, so both can be compared
+static inline double ntel_predict_delay(double last, double slope, long n) {
+    return (n - 1) + (1 - last) / slope;
+}
@@ -20,26 +20,141 @@
 #include "ext.h"
 #include "z_dsp.h"
 #include "ext_obex.h"
+#include "ntel_scan.h"
+#include <stdatomic.h>
+
+// edges detected on the audio thread are passed to the scheduler through a
+// single producer, single consumer ring buffer. must be a power of two.
+#define NTEL_QUEUE_SIZE 1024
+#define NTEL_MAX_GRIDS 64
+
+typedef struct _ntel_event {
+    long lane;      // grid the step belongs to, always 0 without @grids
+    long step;
+    long offset;    // sample within the block the edge was detected in
+    double time;    // scheduler time of that sample
+} t_ntel_event;
+
+// marks the event after which tick switches to the table adopted by the
+// perform routine
+#define NTEL_SWAP -1
+// an edge that was banged ahead of time, only queued for the stats
+#define NTEL_MERGED -2
+
+// latency of the bangs behind the edges, in ms. the first bucket counts bangs
+// that came early (lookahead), the others are below 0.5, 1, 2, ... 32 ms,
+// and the last one is everything above
+#define NTEL_HISTOGRAM_SIZE 9
+
+typedef struct _ntel_stats {
+    long histogram[NTEL_HISTOGRAM_SIZE];
+    long count;
+    double mean;        // running mean and sum of squared differences
+    double m2;
+    double min;
+    double max;
+    long merged;        // edges that were banged ahead of time
+} t_ntel_stats;
+
+enum ntel_signal_mode { NTEL_BANG=0, NTEL_IMPULSE, NTEL_GATE };
+
+// everything derived from the divider and the steps. built on the main
+// thread and handed to the perform routine as a whole
+typedef struct _ntel_table {
+    long divider;
+    long* steps;        // per outlet: the step, or the index into positions
+    // inverted step table: the outlets banging on step s are
+    // step_outlets[step_offsets[s]] to step_outlets[step_offsets[s+1] - 1]
+    long* step_offsets;
+    long* step_outlets;
+    // with float steps: the sorted, distinct positions in the phasor's range,
+    // followed by a sentinel of 2. steps[] then holds the position index
+    t_sample* positions;
+    long n_positions;
+} t_ntel_table;
 
 typedef struct _ntel {
     t_pxobject w_obj;
+    // divider and steps as last set on the main thread. the steps are kept
+    // as given, they are clamped or wrapped when a table is built
     long divider;
+    double* step_values;
+    t_bool* step_floats;    // per outlet: the step was given as a float
+    t_bool floats;      // the steps are positions, if any was a float
+    long n_steps;       // one per outlet, fixed
+    // the table used by the perform routine, the one used by tick (they
+    // differ while a swap is in flight), and the next one to be picked up
+    t_ntel_table* table;
+    t_ntel_table* tick_table;
+    _Atomic(t_ntel_table*) pending;
+    _Atomic(t_ntel_table*) adopted;
+    atomic_bool swap_inflight;
     long current_step;
-    long* steps;
-    long n_steps;
+    long cursor;        // next position to be crossed
+    // with @grids: per grid divider, current step and the phase at which the
+    // next step starts. the perform routine only compares against the
+    // smallest of those
+    long grids[NTEL_MAX_GRIDS];
+    long n_grids;
+    t_sample* grid_dividers;
+    t_sample* grid_next;
+    long* grid_steps;
+    void** grid_outlets;
+    t_sample grid_next_min;
     void* clock;
     void** outlets;
-    void* current_outlet;
-    void** tick_outlets;
+    t_ntel_event* queue;
+    _Atomic long queue_head;    // only written by the perform routine
+    _Atomic long queue_tail;    // only written by tick
+    _Atomic long overflows;
     t_sample history;
+    t_sample input;     // last raw input sample, to scale history again for a new table
+    t_sample* scaled;
+    long* events;
+    long block_size;
+    long signal_mode;
+    char mc;
+    char phaseout;      // signal outlets for the current step and the phase within it
+    long gate_step;     // step whose gate is open, -1 for none
+    // @lookahead: the next edge is predicted from the slope of the phasor and
+    // banged by its own clock, the matching detected edge is then skipped
+    char lookahead;
+    void* predict_clock;
+    long predicted;     // step that was scheduled ahead, -1 for none
+    long predict_age;   // blocks since the prediction
+    _Atomic long predict_step;
+    atomic_bool predict_fired;
+    t_sample slope;     // scaled phase per sample in the last block
+    double samplerate;
+    double predict_time;    // when the predicted bang went out
+    double block_time;      // scheduler time at the start of the block
+    t_ntel_stats stats;     // only touched by tick
+    t_bool created;     // outlets exist, @signal and @mc are fixed
 } t_ntel;
 
 
 void* ntel_new(t_symbol* s, long argc, t_atom* argv);
 void ntel_free(t_ntel* x);
+void ntel_setup_steps(t_ntel* x, long argc, t_atom* argv);
+void ntel_setup_grids(t_ntel* x);
+t_ntel_table* ntel_table_new(t_ntel* x);
+void ntel_table_free(t_ntel_table* t);
+long ntel_seek(const t_ntel_table* t, t_sample phase);
+void ntel_publish(t_ntel* x);
+void ntel_divider(t_ntel* x, long divider);
+void ntel_steps(t_ntel* x, t_symbol* s, long argc, t_atom* argv);
 void ntel_perform64(t_ntel* x, t_object* dsp64, double** ins, long numins, double** outs, long numouts, long sampleframes, long flags, void* userparam);
 void ntel_dsp64(t_ntel* x, t_object* dsp64, short* count, double samplerate, long maxvectorsize, long flags);
+long ntel_multichanneloutputs(t_ntel* x, long index);
+t_max_err ntel_signal_set(t_ntel* x, void* attr, long argc, t_atom* argv);
+t_max_err ntel_mc_set(t_ntel* x, void* attr, long argc, t_atom* argv);
+t_max_err ntel_phaseout_set(t_ntel* x, void* attr, long argc, t_atom* argv);
+t_max_err ntel_grids_set(t_ntel* x, void* attr, long argc, t_atom* argv);
 void tick(t_ntel* x);
+void ntel_predict_tick(t_ntel* x);
+void ntel_overflows(t_ntel* x);
+void ntel_getstats(t_ntel* x);
+void ntel_resetstats(t_ntel* x);
 void ntel_usage(t_ntel* x);
 void ntel_assist(t_ntel* x, void* b, long m, long a, char* s);
 
@@ -49,7 +164,34 @@ void ext_main(void* r) {
     t_class* c = class_new("ntel~", (method)ntel_new, (method)ntel_free, sizeof(t_ntel), NULL, A_GIMME, 0);
     class_addmethod(c, (method)ntel_dsp64,  "dsp64",  A_CANT, 0);
     class_addmethod(c, (method)ntel_usage,  "usage",          0);
+    class_addmethod(c, (method)ntel_overflows, "overflows",   0);
+    class_addmethod(c, (method)ntel_getstats, "getstats",     0);
+    class_addmethod(c, (method)ntel_resetstats, "resetstats", 0);
+    class_addmethod(c, (method)ntel_divider, "divider",  A_LONG, 0);
+    class_addmethod(c, (method)ntel_steps,  "steps",  A_GIMME, 0);
+    class_addmethod(c, (method)ntel_multichanneloutputs, "multichanneloutputs", A_CANT, 0);
     class_addmethod(c, (method)ntel_assist, "assist", A_CANT, 0);
+
+    CLASS_ATTR_LONG(c, "signal", 0, t_ntel, signal_mode);
+    CLASS_ATTR_ENUMINDEX(c, "signal", 0, "bang impulse gate");
+    CLASS_ATTR_LABEL(c, "signal", 0, "Output Mode");
+    CLASS_ATTR_ACCESSORS(c, "signal", NULL, ntel_signal_set);
+
+    CLASS_ATTR_CHAR(c, "mc", 0, t_ntel, mc);
+    CLASS_ATTR_STYLE_LABEL(c, "mc", 0, "onoff", "Multichannel Signal Output");
+    CLASS_ATTR_ACCESSORS(c, "mc", NULL, ntel_mc_set);
+
+    CLASS_ATTR_CHAR(c, "phaseout", 0, t_ntel, phaseout);
+    CLASS_ATTR_STYLE_LABEL(c, "phaseout", 0, "onoff", "Step And Phase Signal Outlets");
+    CLASS_ATTR_ACCESSORS(c, "phaseout", NULL, ntel_phaseout_set);
+
+    CLASS_ATTR_CHAR(c, "lookahead", 0, t_ntel, lookahead);
+    CLASS_ATTR_STYLE_LABEL(c, "lookahead", 0, "onoff", "Schedule Bangs Ahead Of Time");
+
+    CLASS_ATTR_LONG_VARSIZE(c, "grids", 0, t_ntel, grids, n_grids, NTEL_MAX_GRIDS);
+    CLASS_ATTR_LABEL(c, "grids", 0, "Dividers Of Several Grids");
+    CLASS_ATTR_ACCESSORS(c, "grids", NULL, ntel_grids_set);
+
     class_dspinit(c);
     class_register(CLASS_BOX, c);
     s_ntel_class = c;
@@ -60,6 +202,81 @@ void* ntel_new(t_symbol* s, long argc, t_atom* argv) {
 
     dsp_setup((t_pxobject*)x, 1); // one inlet for the phasor
 
+    // attributes decide which outlets we create, so process them first
+    x->gate_step = -1;
+    long attrstart = attr_args_offset(argc, argv);
+    attr_args_process(x, argc, argv);
+    argc = attrstart;
+
+    if(x->n_grids) {
+        if(argc) {
+            object_post((t_object*)x, "divider and steps are ignored with @grids");
+        }
+        ntel_setup_grids(x);
+    } else {
+        ntel_setup_steps(x, argc, argv);
+    }
+    x->created = true;
+
+    x->clock = clock_new(x, (method)tick);
+    x->predict_clock = clock_new(x, (method)ntel_predict_tick);
+    x->predicted = -1;
+    atomic_init(&x->predict_step, 0);
+    atomic_init(&x->predict_fired, false);
+    x->samplerate = sys_getsr();
+    ntel_resetstats(x);
+    x->queue = (t_ntel_event*)sysmem_newptr(NTEL_QUEUE_SIZE * sizeof(t_ntel_event));
+    atomic_init(&x->queue_head, 0);
+    atomic_init(&x->queue_tail, 0);
+    atomic_init(&x->overflows, 0);
+
+    atomic_init(&x->pending, NULL);
+    atomic_init(&x->adopted, NULL);
+    atomic_init(&x->swap_inflight, false);
+
+    x->current_step = 0;
+    x->history = 0;
+    x->input = 0;
+    x->scaled = NULL;
+    x->events = NULL;
+    x->block_size = 0;
+
+    return x;
+}
+
+void ntel_free(t_ntel* x) {
+    dsp_free((t_pxobject*)x);
+    freeobject(x->clock);
+    freeobject(x->predict_clock);
+    sysmem_freeptr(x->step_values);
+    sysmem_freeptr(x->step_floats);
+    sysmem_freeptr(x->outlets);
+    if(x->tick_table != x->table) {
+        ntel_table_free(x->tick_table);
+    }
+    ntel_table_free(x->table);
+    ntel_table_free(atomic_load(&x->pending));
+    sysmem_freeptr(x->scaled);
+    sysmem_freeptr(x->events);
+    sysmem_freeptr(x->queue);
+    sysmem_freeptr(x->grid_dividers);
+    sysmem_freeptr(x->grid_next);
+    sysmem_freeptr(x->grid_steps);
+    sysmem_freeptr(x->grid_outlets);
+}
+
+// steps given as floats are positions in the range of the phasor rather
+// than whole steps, e.g. [ntel~ 4 0.5] bangs at 0.125. if any outlet has
+// one, the steps of all outlets are positions
+static void ntel_update_floats(t_ntel* x) {
+    x->floats = false;
+    for(long i=0; i<x->n_steps; i++) {
+        x->floats |= x->step_floats[i];
+    }
+}
+
+// parses the divider and step arguments and creates one outlet per step
+void ntel_setup_steps(t_ntel* x, long argc, t_atom* argv) {
     if(!argc) {
         object_post((t_object*)x, "no divider given, defaulting to 1");
         x->divider = 1;
@@ -85,98 +302,775 @@ void* ntel_new(t_symbol* s, long argc, t_atom* argv) {
         x->n_steps = n_steps;
     }
 
-    x->outlets      = (void**)sysmem_newptr(x->n_steps * sizeof(void*));
-    x->tick_outlets = (void**)sysmem_newptr(x->n_steps * sizeof(void*));
-    x->steps        = (long*) sysmem_newptr(x->n_steps * sizeof(long));
+    // outlets are created from right to left, the phase within the step is
+    // the rightmost one, the current step is left of it
+    if(x->phaseout) {
+        outlet_new((t_object*)x, "signal");
+        outlet_new((t_object*)x, "signal");
+    }
+
+    x->step_values  = (double*)sysmem_newptr(x->n_steps * sizeof(double));
+    x->step_floats  = (t_bool*)sysmem_newptr(x->n_steps * sizeof(t_bool));
+    if(x->signal_mode == NTEL_BANG) {
+        x->outlets  = (void**)sysmem_newptr(x->n_steps * sizeof(void*));
+    } else if(x->mc) {
+        // all steps on one outlet, one channel per step
+        outlet_new((t_object*)x, "multichannelsignal");
+    }
 
     for(int i=0; i<x->n_steps; i++) {
-        if(no_steps) {
-            x->steps[i] = i;
+        x->step_values[i] = no_steps ? i : atom_getfloat(argv + 1 + i);
+        x->step_floats[i] = !no_steps && atom_gettype(argv + 1 + i) == A_FLOAT;
+
+        if(x->signal_mode == NTEL_BANG) {
+            // outlets are created from right to left, we reverse the order
+            // so that they line up with the order of the arguments
+            int rev_i = x->n_steps - i - 1;
+            x->outlets[rev_i] = bangout(x);
+        } else if(!x->mc) {
+            // signal outlets all look the same, the perform routine gets
+            // them from left to right
+            outlet_new((t_object*)x, "signal");
+        }
+    }
+    assert(x->n_steps > 0);
+    ntel_update_floats(x);
+
+    x->table = ntel_table_new(x);
+    x->tick_table = x->table;
+    if(x->table->positions) {
+        x->cursor = ntel_seek(x->table, 0);
+    }
+}
+
+// @grids: one int outlet per grid, outputting the index of each step as the
+// phasor enters it
+void ntel_setup_grids(t_ntel* x) {
+    if(x->signal_mode != NTEL_BANG) {
+        object_warn((t_object*)x, "@signal is ignored with @grids");
+        x->signal_mode = NTEL_BANG;
+    }
+    if(x->phaseout) {
+        object_warn((t_object*)x, "@phaseout is ignored with @grids");
+        x->phaseout = 0;
+    }
+
+    long n = x->n_grids;
+    x->grid_dividers = (t_sample*)sysmem_newptr(n * sizeof(t_sample));
+    x->grid_next     = (t_sample*)sysmem_newptr(n * sizeof(t_sample));
+    x->grid_steps    = (long*)    sysmem_newptrclear(n * sizeof(long));
+    x->grid_outlets  = (void**)   sysmem_newptr(n * sizeof(void*));
+
+    x->grid_next_min = 1;
+    for(long g=0; g<n; g++) {
+        x->grid_dividers[g] = x->grids[g];
+        x->grid_next[g] = 1. / x->grids[g];
+        x->grid_next_min = MIN(x->grid_next_min, x->grid_next[g]);
+        x->grid_outlets[n - g - 1] = intout(x);
+    }
+}
+
+// the step of outlet `i` in the range of the divider. whole steps are
+// clamped, positions are on a circle, so they wrap around
+static double ntel_step_value(t_ntel* x, long i) {
+    double step = x->step_values[i];
+    if(x->floats) {
+        return step - floor(step / x->divider) * x->divider;
+    }
+    // TODO: might be more useful to do modulo
+    return CLAMP((long)step, 0, x->divider - 1);
+}
+
+// groups the outlets by the step they bang on (counting sort), so that an
+// edge only has to look at the outlets that actually fire. there are
+// `n_buckets` steps (or positions) and steps[] holds the one for each outlet
+static void ntel_build_step_table(t_ntel_table* t, long n_steps, long n_buckets) {
+    t->step_offsets = (long*)sysmem_newptrclear((n_buckets + 1) * sizeof(long));
+    t->step_outlets = (long*)sysmem_newptr(n_steps * sizeof(long));
+
+    for(long i=0; i<n_steps; i++) {
+        t->step_offsets[t->steps[i] + 1]++;
+    }
+    for(long s=0; s<n_buckets; s++) {
+        t->step_offsets[s + 1] += t->step_offsets[s];
+    }
+
+    long* cursor = (long*)sysmem_newptr(n_buckets * sizeof(long));
+    sysmem_copyptr(t->step_offsets, cursor, n_buckets * sizeof(long));
+    for(long i=0; i<n_steps; i++) {
+        t->step_outlets[cursor[t->steps[i]]++] = i;
+    }
+    sysmem_freeptr(cursor);
+}
+
+static int ntel_compare_thresholds(const void* a, const void* b) {
+    double d = *(const double*)a - *(const double*)b;
+    return (d > 0) - (d < 0);
+}
+
+// index of the first position above `phase`
+long ntel_seek(const t_ntel_table* t, t_sample phase) {
+    long lo = 0;
+    long hi = t->n_positions;
+    while(lo < hi) {
+        long mid = (lo + hi) / 2;
+        if(t->positions[mid] <= phase) {
+            lo = mid + 1;
         } else {
-            // check if user has supplied valid step numbers, clamp if outside
-            // TODO: might be more useful to do modulo
-            long step = atom_getlong(argv + 1 + i);
-            long highest_step = x->divider - 1;
-            if(step < 0 || step > highest_step) {
-                object_post((t_object*)x, "step nr %ld with value %ld clamped to range 0 - %ld", i+1, step, highest_step);
-                step = CLAMP(step, 0, highest_step);
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// sorts the thresholds of all outlets into a table of distinct positions
+static void ntel_build_positions(t_ntel_table* t, long n_steps, double* thresholds) {
+    double* sorted = (double*)sysmem_newptr(n_steps * sizeof(double));
+    sysmem_copyptr(thresholds, sorted, n_steps * sizeof(double));
+    qsort(sorted, n_steps, sizeof(double), ntel_compare_thresholds);
+
+    t->positions = (t_sample*)sysmem_newptr((n_steps + 1) * sizeof(t_sample));
+    t->n_positions = 0;
+    for(long i=0; i<n_steps; i++) {
+        if(!t->n_positions || sorted[i] != t->positions[t->n_positions - 1]) {
+            t->positions[t->n_positions++] = sorted[i];
+        }
+    }
+    // the phase never reaches 2, so the cursor never runs past the end
+    t->positions[t->n_positions] = 2;
+    sysmem_freeptr(sorted);
+
+    for(long i=0; i<n_steps; i++) {
+        t->steps[i] = ntel_seek(t, thresholds[i]) - 1;
+    }
+}
+
+// builds a table from the current divider and steps. main thread only
+t_ntel_table* ntel_table_new(t_ntel* x) {
+    t_ntel_table* t = (t_ntel_table*)sysmem_newptrclear(sizeof(t_ntel_table));
+    t->divider = x->divider;
+    t->steps = (long*)sysmem_newptr(x->n_steps * sizeof(long));
+
+    double* thresholds = x->floats ? (double*)sysmem_newptr(x->n_steps * sizeof(double)) : NULL;
+    for(long i=0; i<x->n_steps; i++) {
+        double step = ntel_step_value(x, i);
+        if(thresholds) {
+            if(step != x->step_values[i]) {
+                object_post((t_object*)x, "step nr %ld with value %f wrapped to %f", i+1, x->step_values[i], step);
+            }
+            thresholds[i] = step / x->divider;
+        } else {
+            if(step != (long)x->step_values[i]) {
+                object_post((t_object*)x, "step nr %ld with value %ld clamped to range 0 - %ld", i+1, (long)x->step_values[i], x->divider - 1);
             }
-            x->steps[i] = step;
+            t->steps[i] = step;
         }
+    }
 
-        // outlets are created from right to left, we reverse the order
-        // so that they line up with the order of the arguments
-        int rev_i = x->n_steps - i - 1;
-        x->outlets[rev_i] = bangout(x);
+    if(thresholds) {
+        ntel_build_positions(t, x->n_steps, thresholds);
+        ntel_build_step_table(t, x->n_steps, t->n_positions);
+        sysmem_freeptr(thresholds);
+    } else {
+        ntel_build_step_table(t, x->n_steps, t->divider);
+    }
+    return t;
+}
+
+void ntel_table_free(t_ntel_table* t) {
+    if(!t) {
+        return;
+    }
+    sysmem_freeptr(t->steps);
+    sysmem_freeptr(t->step_offsets);
+    sysmem_freeptr(t->step_outlets);
+    sysmem_freeptr(t->positions);
+    sysmem_freeptr(t);
+}
 
-        x->tick_outlets[i] = NULL;
+// hands a new table to the perform routine. if it hasn't picked up the
+// previous one yet, that one is replaced and freed right here
+void ntel_publish(t_ntel* x) {
+    t_ntel_table* old = atomic_exchange(&x->pending, ntel_table_new(x));
+    ntel_table_free(old);
+}
 
+void ntel_divider(t_ntel* x, long divider) {
+    if(x->n_grids) {
+        object_error((t_object*)x, "divider can't be changed with @grids");
+        return;
     }
-    assert(x->n_steps > 0);
-    x->current_outlet = x->outlets[0];
+    if(divider < 1) {
+        object_post((t_object*)x, "divider must be at least 1, defaulting to 1");
+        divider = 1;
+    }
+    x->divider = divider;
+    ntel_publish(x);
+}
 
-    x->clock = clock_new(x, (method)tick);
+// sets the steps of the outlets from left to right. outlets without a new
+// step keep their old one
+void ntel_steps(t_ntel* x, t_symbol* s, long argc, t_atom* argv) {
+    if(x->n_grids) {
+        object_error((t_object*)x, "steps can't be changed with @grids");
+        return;
+    }
+    if(argc > x->n_steps) {
+        object_post((t_object*)x, "%ld steps given for %ld outlets, ignoring the rest", argc, x->n_steps);
+        argc = x->n_steps;
+    }
 
-    x->current_step = 0;
-    x->history = 0;
+    for(long i=0; i<argc; i++) {
+        x->step_values[i] = atom_getfloat(argv + i);
+        x->step_floats[i] = atom_gettype(argv + i) == A_FLOAT;
+    }
+    ntel_update_floats(x);
+    ntel_publish(x);
+}
 
-    return x;
+// called from the perform routine only. never blocks or allocates, if the
+// queue is full the edge is dropped and counted
+static inline t_bool ntel_queue_push(t_ntel* x, long lane, long step, long offset) {
+    long head = atomic_load_explicit(&x->queue_head, memory_order_relaxed);
+    long tail = atomic_load_explicit(&x->queue_tail, memory_order_acquire);
+    if(head - tail >= NTEL_QUEUE_SIZE) {
+        atomic_fetch_add_explicit(&x->overflows, 1, memory_order_relaxed);
+        return false;
+    }
+
+    t_ntel_event* event = x->queue + (head & (NTEL_QUEUE_SIZE - 1));
+    event->lane = lane;
+    event->step = step;
+    event->offset = offset;
+    event->time = x->block_time + offset * 1000. / x->samplerate;
+    atomic_store_explicit(&x->queue_head, head + 1, memory_order_release);
+    return true;
 }
 
-void ntel_free(t_ntel* x) {
-    dsp_free((t_pxobject*)x);
-    freeobject(x->clock);
-    sysmem_freeptr(x->steps);
-    sysmem_freeptr(x->outlets);
-    sysmem_freeptr(x->tick_outlets);
+// state of the perform routine while it walks the edges of one block
+typedef struct _ntel_block {
+    t_ntel_table* t;
+    double** outs;
+    t_sample* step_out;     // @phaseout outlets, NULL if there are none
+    t_sample* phase_out;
+    long gate_start;    // first sample of the open gate
+    t_bool pushed;      // any edges queued for the scheduler
+} t_ntel_block;
+
+// opens the gate of the outlets for `x->gate_step` from `b->gate_start` to `end`
+static inline void ntel_gate(t_ntel* x, t_ntel_block* b, long end) {
+    t_ntel_table* t = b->t;
+    long step = x->gate_step;
+    if(step >= 0) {
+        for(long k=t->step_offsets[step]; k<t->step_offsets[step + 1]; k++) {
+            t_sample* out = b->outs[t->step_outlets[k]];
+            for(long i=b->gate_start; i<end; i++) {
+                out[i] = 1;
+            }
+        }
+    }
+    b->gate_start = end;
 }
 
-void ntel_perform64(t_ntel* x, t_object* dsp64, double** ins, long numins, double** outs, long numouts, long sampleframes, long flags, void* userparam) {
-    t_sample* in = ins[0];
-    long n = sampleframes;
-    while(n--) {
-        t_sample phase = *in++;
+// the outlets of `step` fire on sample `i`
+static inline void ntel_fire(t_ntel* x, t_ntel_block* b, long step, long i) {
+    t_ntel_table* t = b->t;
+    if(x->signal_mode == NTEL_GATE) {
+        // the previous step's gate closes, this one's opens
+        ntel_gate(x, b, i);
+        x->gate_step = step;
+    } else if(t->step_offsets[step] != t->step_offsets[step + 1]) {
+        // only act on the edge if any outlet bangs on this step
+        if(x->signal_mode == NTEL_IMPULSE) {
+            for(long k=t->step_offsets[step]; k<t->step_offsets[step + 1]; k++) {
+                b->outs[t->step_outlets[k]][i] = 1;
+            }
+        } else {
+            b->pushed |= ntel_queue_push(x, 0, step, i);
+        }
+    }
+}
+
+// falls back to the detected edge. if the predicted bang is already out,
+// the detected edge is still skipped when it comes, unless `reset` is set
+// because the step sequence starts over
+static void ntel_cancel_prediction(t_ntel* x, t_bool reset) {
+    if(x->predicted < 0) {
+        return;
+    }
+    if(!atomic_load_explicit(&x->predict_fired, memory_order_acquire)) {
+        clock_unset(x->predict_clock);
+        x->predicted = -1;
+    } else if(reset) {
+        x->predicted = -1;
+    }
+}
+
+// @lookahead: measures how fast the scaled phase rises and, if the next edge
+// falls into the next block, schedules its bang now with sub-millisecond
+// precision instead of waiting for the edge to be detected. only whole steps
+// with bang outlets are predicted
+static void ntel_predict(t_ntel* x, t_ntel_block* b, t_sample rise, t_sample* scaled, long n) {
+    if(n < 2) {
+        return;
+    }
 
-        // scale frequency of input phase by `divider`
-        // this will make a phasor at 1Hz go `divider` times faster
-        phase *= x->divider;
-        phase = fmod(fabs(phase), 1);
+    // the phasor wraps at most once per block if it is slow enough to predict
+    if(rise < 0) {
+        rise += 1;
+    }
+    t_sample previous = x->slope;
+    x->slope = rise * b->t->divider / (n - 1);
+    // a change of more than 1% counts as a tempo jump
+    t_bool steady = fabs(x->slope - previous) <= previous * 0.01;
+
+    if(x->predicted >= 0) {
+        // still waiting for the predicted edge. if the tempo jumped or the
+        // edge is late, the prediction can't be trusted anymore
+        if(!steady || ++x->predict_age > 2) {
+            ntel_cancel_prediction(x, false);
+        }
+        return;
+    }
 
-        t_sample delta = phase - x->history;
+    // stalled, unsteady, or more than one edge per block
+    if(!steady || x->slope <= 0 || x->slope * n >= 1) {
+        return;
+    }
+    // counted from the start of the block, like the detected edges
+    double delay = ntel_predict_delay(scaled[n - 1], x->slope, n);
+    long step = x->current_step;
+    if(delay >= 2 * n - 1 || b->t->step_offsets[step] == b->t->step_offsets[step + 1]) {
+        return;
+    }
+
+    x->predicted = step;
+    x->predict_age = 0;
+    atomic_store_explicit(&x->predict_step, step, memory_order_relaxed);
+    atomic_store_explicit(&x->predict_fired, false, memory_order_release);
+    clock_fdelay(x->predict_clock, delay * 1000. / x->samplerate);
+}
+
+static inline void ntel_fill(t_sample* out, long start, long end, t_sample value) {
+    for(long i=start; i<end; i++) {
+        out[i] = value;
+    }
+}
+
+// whole steps: a step is reached when the scaled phase falls
+static void ntel_perform_steps(t_ntel* x, t_ntel_block* b, t_sample* scaled, long n) {
+    long* events = x->events;
+    long n_events = ntel_scan(scaled, x->history, events, n);
+
+    // the step that fired last only changes at the events, so its outlet is
+    // filled in runs between them. the phase within that step is the scaled
+    // phase. after a reset, the phasor is still in the last step of the cycle
+    long divider = b->t->divider;
+    long run_start = 0;
+    if(b->phase_out) {
+        sysmem_copyptr(scaled, b->phase_out, n * sizeof(t_sample));
+    }
+
+    for(long e=0; e<n_events; e++) {
+        long i = events[e];
+        t_sample delta = scaled[i] - (i ? scaled[i - 1] : x->history);
+        if(b->step_out) {
+            ntel_fill(b->step_out, run_start, i, (x->current_step + divider - 1) % divider);
+            run_start = i;
+        }
         if(delta < 0) {
             // check if one scaled clock cycle has passed (falling edge)
-            for(int i=0; i<x->n_steps; i++) {
-                // search for all steps that match current_step
-                if(x->steps[i] == x->current_step) {
-                    x->tick_outlets[i] = x->outlets[i];
-                } else {
-                    x->tick_outlets[i] = NULL;
-                }
+            if(x->current_step == x->predicted) {
+                // already banged ahead of time, tick still measures how
+                // early it was
+                x->predicted = -1;
+                b->pushed |= ntel_queue_push(x, 0, NTEL_MERGED, i);
+            } else {
+                ntel_fire(x, b, x->current_step, i);
             }
-            clock_delay(x->clock, 0);
 
             //increase counter
-            x->current_step = (x->current_step+1) % x->divider;
-        } else if(delta == 0) {
-            // if the phasor has been turned off, reset the step sequence
+            x->current_step = (x->current_step+1) % b->t->divider;
+        } else {
+            // if the phasor has been turned off, reset the step sequence.
+            // edges that were already queued still go out
             x->current_step = 0;
-            clock_unset(x->clock);
+            ntel_cancel_prediction(x, true);
+            if(x->signal_mode == NTEL_GATE) {
+                ntel_gate(x, b, i);
+                x->gate_step = -1;
+            }
+        }
+    }
+
+    if(b->step_out) {
+        ntel_fill(b->step_out, run_start, n, (x->current_step + divider - 1) % divider);
+    }
+}
+
+// float positions: the cursor points at the next position to be crossed, so
+// each sample costs one compare against it, no matter how many positions
+// there are. a stalled phasor simply crosses nothing
+static void ntel_perform_positions(t_ntel* x, t_ntel_block* b, t_sample* phase, long n) {
+    t_sample* positions = b->t->positions;
+    long n_positions = b->t->n_positions;
+    long cursor = x->cursor;
+    t_sample next = positions[cursor];
+    t_sample prev = x->history;
+
+    for(long i=0; i<n; i++) {
+        t_sample p = phase[i];
+        if(p < prev) {
+            // the phasor wrapped, the rest of the cycle is crossed as well
+            for(; cursor < n_positions; cursor++) {
+                ntel_fire(x, b, cursor, i);
+            }
+            cursor = 0;
+            next = positions[0];
+        }
+        while(p >= next) {
+            ntel_fire(x, b, cursor, i);
+            next = positions[++cursor];
+        }
+        prev = p;
+    }
+
+    x->cursor = cursor;
+}
+
+// works out which grids entered a new step at sample `i` and returns where
+// the next one starts. a wrap starts a new step on every grid
+static t_sample ntel_grids_advance(t_ntel* x, t_ntel_block* b, t_sample phase, t_bool wrapped, long i) {
+    t_sample next_min = 1;
+    for(long g=0; g<x->n_grids; g++) {
+        long step = (long)(phase * x->grid_dividers[g]);
+        if(wrapped || step != x->grid_steps[g]) {
+            x->grid_steps[g] = step;
+            b->pushed |= ntel_queue_push(x, g, step, i);
+        }
+        x->grid_next[g] = (step + 1) / x->grid_dividers[g];
+        next_min = MIN(next_min, x->grid_next[g]);
+    }
+    return next_min;
+}
+
+// @grids: the phase is computed once for all grids. a sample only costs one
+// compare against the earliest upcoming step of any grid (and one against the
+// previous phase for wraps), the grids are only looked at when that is hit
+static void ntel_perform_grids(t_ntel* x, t_ntel_block* b, t_sample* phase, long n) {
+    t_sample next = x->grid_next_min;
+    t_sample prev = x->history;
+
+    for(long i=0; i<n; i++) {
+        t_sample p = phase[i];
+        if(p < prev || p >= next) {
+            next = ntel_grids_advance(x, b, p, p < prev, i);
+        }
+        prev = p;
+    }
+
+    x->grid_next_min = next;
+}
+
+// picks up a table published by the main thread. only one swap is in
+// flight at a time: tick has to be done with the old table before it can be
+// freed, and it learns about the new one from a marker in the event queue
+static t_bool ntel_adopt(t_ntel* x) {
+    if(atomic_load_explicit(&x->swap_inflight, memory_order_acquire)) {
+        return false;
+    }
+    // the marker has to fit into the queue, otherwise try again next block
+    long head = atomic_load_explicit(&x->queue_head, memory_order_relaxed);
+    long tail = atomic_load_explicit(&x->queue_tail, memory_order_acquire);
+    if(head - tail >= NTEL_QUEUE_SIZE) {
+        return false;
+    }
+
+    t_ntel_table* t = atomic_exchange_explicit(&x->pending, NULL, memory_order_acquire);
+    x->table = t;
+    atomic_store_explicit(&x->adopted, t, memory_order_relaxed);
+    atomic_store_explicit(&x->swap_inflight, true, memory_order_relaxed);
+    ntel_queue_push(x, 0, NTEL_SWAP, 0);
+
+    // carry the position in the cycle over to the new table: history, step
+    // and cursor are worked out from the last input as if the new table had
+    // been in use all along, so the next sample compares like with like. an
+    // open gate belongs to the old steps, it closes and the next step opens
+    // a new one
+    ntel_cancel_prediction(x, true);
+    if(x->n_grids || t->positions) {
+        t_sample phase = fabs(x->input);
+        x->history = phase - floor(phase);
+        if(t->positions) {
+            x->cursor = ntel_seek(t, x->history);
         }
+    } else {
+        // the step that fires next is the one the scaled phase is in
+        t_sample phase = fabs(x->input * t->divider);
+        x->history = phase - floor(phase);
+        x->current_step = (long)fmod(floor(phase), t->divider);
+    }
+    x->gate_step = -1;
+    return true;
+}
 
-        x->history = phase;
+void ntel_perform64(t_ntel* x, t_object* dsp64, double** ins, long numins, double** outs, long numouts, long sampleframes, long flags, void* userparam) {
+    t_sample* in = ins[0];
+    t_sample* scaled = x->scaled;
+    long n = MIN(sampleframes, x->block_size);
+
+    if(!n) {
+        return;
+    }
+
+    clock_getftime(&x->block_time);
+
+    t_ntel_block b = { x->table, outs, NULL, NULL, 0, false };
+    if(b.t && atomic_load_explicit(&x->pending, memory_order_relaxed)) {
+        // the marker needs a tick as well
+        b.pushed = ntel_adopt(x);
+        b.t = x->table;
     }
+
+    // positions and grids are relative to the unscaled phase
+    t_sample divider = (x->n_grids || b.t->positions) ? 1 : b.t->divider;
+
+    ntel_scale(in, scaled, divider, n);
+
+    // the input may share its memory with the outputs, so everything that is
+    // still needed from it has to be read before they are written
+    t_sample rise = in[n - 1] - in[0];
+    x->input = in[n - 1];
+
+    long n_step_outs = numouts;
+    if(x->phaseout) {
+        // the two rightmost signal outlets
+        n_step_outs -= 2;
+        b.step_out = outs[n_step_outs];
+        b.phase_out = outs[n_step_outs + 1];
+        if(x->n_grids || b.t->positions) {
+            // only whole steps have a step index and a phase within the step
+            set_zero64(b.step_out, sampleframes);
+            set_zero64(b.phase_out, sampleframes);
+            b.step_out = NULL;
+            b.phase_out = NULL;
+        }
+    }
+
+    // in the signal modes, the outputs are silent except for the samples
+    // written at the edges below. the whole input has already been read into
+    // `scaled`, so writing the outputs in place is fine
+    if(x->signal_mode != NTEL_BANG) {
+        for(long j=0; j<n_step_outs; j++) {
+            set_zero64(outs[j], sampleframes);
+        }
+    }
+
+    if(x->n_grids) {
+        ntel_perform_grids(x, &b, scaled, n);
+    } else if(b.t->positions) {
+        ntel_perform_positions(x, &b, scaled, n);
+    } else {
+        ntel_perform_steps(x, &b, scaled, n);
+        // tick has to use the same table as the prediction, so there are no
+        // predictions while a swap is in flight
+        if(x->lookahead && x->signal_mode == NTEL_BANG
+           && !atomic_load_explicit(&x->swap_inflight, memory_order_relaxed)) {
+            ntel_predict(x, &b, rise, scaled, n);
+        }
+    }
+
+    if(x->signal_mode == NTEL_GATE) {
+        ntel_gate(x, &b, n);
+    }
+
+    if(b.pushed) {
+        clock_delay(x->clock, 0);
+    }
+
+    x->history = scaled[n - 1];
 }
 
 void ntel_dsp64(t_ntel* x, t_object* dsp64, short* count, double samplerate, long maxvectorsize, long flags) {
+    x->samplerate = samplerate;
+
+    // scratch space for the per-block passes in the perform routine
+    if(maxvectorsize > x->block_size) {
+        sysmem_freeptr(x->scaled);
+        sysmem_freeptr(x->events);
+        x->scaled = (t_sample*)sysmem_newptr(maxvectorsize * sizeof(t_sample));
+        x->events = (long*)sysmem_newptr(maxvectorsize * sizeof(long));
+        x->block_size = maxvectorsize;
+    }
+
     object_method(dsp64, gensym("dsp_add64"), x, ntel_perform64, 0, NULL);
 }
 
+long ntel_multichanneloutputs(t_ntel* x, long index) {
+    // the @phaseout outlets are single channel
+    return (x->mc && x->signal_mode != NTEL_BANG && index == 0) ? x->n_steps : 1;
+}
+
+// @signal and @mc decide which outlets exist, so they can only be given as
+// object arguments
+
+t_max_err ntel_signal_set(t_ntel* x, void* attr, long argc, t_atom* argv) {
+    if(x->created) {
+        object_error((t_object*)x, "@signal can only be set as an object argument");
+        return MAX_ERR_GENERIC;
+    }
+    if(argc && argv) {
+        x->signal_mode = CLAMP(atom_getlong(argv), NTEL_BANG, NTEL_GATE);
+    }
+    return MAX_ERR_NONE;
+}
+
+t_max_err ntel_mc_set(t_ntel* x, void* attr, long argc, t_atom* argv) {
+    if(x->created) {
+        object_error((t_object*)x, "@mc can only be set as an object argument");
+        return MAX_ERR_GENERIC;
+    }
+    if(argc && argv) {
+        x->mc = atom_getlong(argv) != 0;
+    }
+    return MAX_ERR_NONE;
+}
+
+t_max_err ntel_phaseout_set(t_ntel* x, void* attr, long argc, t_atom* argv) {
+    if(x->created) {
+        object_error((t_object*)x, "@phaseout can only be set as an object argument");
+        return MAX_ERR_GENERIC;
+    }
+    if(argc && argv) {
+        x->phaseout = atom_getlong(argv) != 0;
+    }
+    return MAX_ERR_NONE;
+}
+
+t_max_err ntel_grids_set(t_ntel* x, void* attr, long argc, t_atom* argv) {
+    if(x->created) {
+        object_error((t_object*)x, "@grids can only be set as an object argument");
+        return MAX_ERR_GENERIC;
+    }
+    x->n_grids = 0;
+    for(long i=0; i<argc && x->n_grids<NTEL_MAX_GRIDS; i++) {
+        long divider = atom_getlong(argv + i);
+        if(divider < 1) {
+            object_post((t_object*)x, "grid divider %ld must be at least 1, skipping", divider);
+            continue;
+        }
+        x->grids[x->n_grids++] = divider;
+    }
+    return MAX_ERR_NONE;
+}
+
+// adds one latency measurement in ms (welford's online mean and variance)
+static void ntel_stats_add(t_ntel_stats* stats, double latency) {
+    long bucket = 0;
+    if(latency >= 0) {
+        bucket = 1;
+        for(double limit = 0.5; latency >= limit && bucket < NTEL_HISTOGRAM_SIZE - 1; limit *= 2) {
+            bucket++;
+        }
+    }
+    stats->histogram[bucket]++;
+
+    stats->count++;
+    double delta = latency - stats->mean;
+    stats->mean += delta / stats->count;
+    stats->m2 += delta * (latency - stats->mean);
+    stats->min = MIN(stats->min, latency);
+    stats->max = MAX(stats->max, latency);
+}
+
+// drains all queued edges in the order they were detected
 void tick(t_ntel* x) {
-    for(int i=0; i<x->n_steps; i++) {
-        if(x->tick_outlets[i]) {
-            outlet_bang(x->tick_outlets[i]);
+    double now;
+    clock_getftime(&now);
+
+    long tail = atomic_load_explicit(&x->queue_tail, memory_order_relaxed);
+    long head = atomic_load_explicit(&x->queue_head, memory_order_acquire);
+
+    for(; tail != head; tail++) {
+        t_ntel_event event = x->queue[tail & (NTEL_QUEUE_SIZE - 1)];
+        atomic_store_explicit(&x->queue_tail, tail + 1, memory_order_release);
+
+        if(event.step == NTEL_MERGED) {
+            x->stats.merged++;
+            ntel_stats_add(&x->stats, x->predict_time - event.time);
+            continue;
         }
+        if(event.step != NTEL_SWAP) {
+            ntel_stats_add(&x->stats, now - event.time);
+        }
+
+        if(x->n_grids) {
+            outlet_int(x->grid_outlets[event.lane], event.step);
+            continue;
+        }
+
+        t_ntel_table* t = x->tick_table;
+        if(event.step == NTEL_SWAP) {
+            // everything before the marker was detected with the old table
+            x->tick_table = atomic_load_explicit(&x->adopted, memory_order_relaxed);
+            ntel_table_free(t);
+            atomic_store_explicit(&x->swap_inflight, false, memory_order_release);
+            continue;
+        }
+        for(long i=t->step_offsets[event.step]; i<t->step_offsets[event.step + 1]; i++) {
+            outlet_bang(x->outlets[t->step_outlets[i]]);
+        }
+    }
+}
+
+// bangs the step predicted by the perform routine
+void ntel_predict_tick(t_ntel* x) {
+    long step = atomic_load_explicit(&x->predict_step, memory_order_relaxed);
+    atomic_store_explicit(&x->predict_fired, true, memory_order_release);
+    clock_getftime(&x->predict_time);
+
+    t_ntel_table* t = x->tick_table;
+    if(t->positions || step >= t->divider) {
+        return;
+    }
+    for(long i=t->step_offsets[step]; i<t->step_offsets[step + 1]; i++) {
+        outlet_bang(x->outlets[t->step_outlets[i]]);
+    }
+}
+
+void ntel_overflows(t_ntel* x) {
+    object_post((t_object*)x, "%ld edges dropped because the event queue was full", atomic_load(&x->overflows));
+}
+
+void ntel_getstats(t_ntel* x) {
+    t_ntel_stats* stats = &x->stats;
+    object_post((t_object*)x, "latency of %ld bangs behind their edges:", stats->count);
+    if(stats->count) {
+        double std = stats->count > 1 ? sqrt(stats->m2 / (stats->count - 1)) : 0;
+        object_post((t_object*)x, "mean %.3f ms, std %.3f ms, min %.3f ms, max %.3f ms", stats->mean, std, stats->min, stats->max);
+    }
+
+    object_post((t_object*)x, "early: %ld", stats->histogram[0]);
+    double limit = 0.5;
+    for(long i=1; i<NTEL_HISTOGRAM_SIZE - 1; i++, limit *= 2) {
+        object_post((t_object*)x, "< %g ms: %ld", limit, stats->histogram[i]);
     }
+    object_post((t_object*)x, ">= %g ms: %ld", limit / 2, stats->histogram[NTEL_HISTOGRAM_SIZE - 1]);
+
+    object_post((t_object*)x, "%ld edges banged ahead of time, %ld dropped", stats->merged, atomic_load(&x->overflows));
+}
+
+void ntel_resetstats(t_ntel* x) {
+    t_ntel_stats* stats = &x->stats;
+    for(long i=0; i<NTEL_HISTOGRAM_SIZE; i++) {
+        stats->histogram[i] = 0;
+    }
+    stats->count = 0;
+    stats->mean = 0;
+    stats->m2 = 0;
+    stats->min = INFINITY;
+    stats->max = -INFINITY;
+    stats->merged = 0;
 }
 
 void ntel_usage(t_ntel* x) {
@@ -185,16 +1079,63 @@ void ntel_usage(t_ntel* x) {
     object_post((t_object*)x, "args 2...n: (list) on which steps to trigger bang (count starts at 0)");
     object_post((t_object*)x, "if args 2...n is empty, steps 0 .. (value of arg 1) - 1 are automatically generated");
     object_post((t_object*)x, "arguments in args 2...n cannot be larger than (value of arg 1) - 1");
+    object_post((t_object*)x, "a step bangs when the phasor leaves it, i.e. step k at (k + 1) / arg 1");
+    object_post((t_object*)x, "if any of args 2...n is a float, they are exact positions (step / arg 1) in the range of the phasor");
+    object_post((t_object*)x, "a position bangs where its step starts, so 1.0 bangs one step before 1");
+    object_post((t_object*)x, "@signal 1 or 2: output a 1-sample impulse or a gate per step instead of bangs");
+    object_post((t_object*)x, "@mc 1: with @signal, output all steps on one multichannel outlet");
+    object_post((t_object*)x, "@phaseout 1: add signal outlets for the current step and the phase within it");
+    object_post((t_object*)x, "@lookahead 1: predict the next step from the speed of the phasor and bang it on time");
+    object_post((t_object*)x, "@grids d1 d2 ...: instead of the arguments, divide the phasor into several grids with one outlet each, outputting the step index");
+    object_post((t_object*)x, "message divider (int): change the divider, the steps stay the same");
+    object_post((t_object*)x, "message steps (list): change the steps of the outlets, from left to right");
+    object_post((t_object*)x, "message overflows: post how many steps were dropped because the scheduler fell behind");
+    object_post((t_object*)x, "message getstats: post how late the bangs are, resetstats to start over");
 }
 
 void ntel_assist(t_ntel* x, void* b, long m, long a, char* s) {
     if (m == ASSIST_INLET) {
         snprintf_zero(s, 256, "(signal) Phasor input (0 - 1)");
     } else if(m == ASSIST_OUTLET) {
-        if(a >= x->n_steps || x->steps == NULL) {
+        if(x->n_grids) {
+            if(a < x->n_grids) {
+                snprintf_zero(s, 256, "(int) Step of grid with divider %ld", x->grids[a]);
+            }
+            return;
+        }
+        long n_step_outlets = (x->signal_mode != NTEL_BANG && x->mc) ? 1 : x->n_steps;
+        if(x->phaseout && a == n_step_outlets) {
+            snprintf_zero(s, 256, "(signal) Current step");
+            return;
+        }
+        if(x->phaseout && a == n_step_outlets + 1) {
+            snprintf_zero(s, 256, "(signal) Phase within the current step (0 - 1)");
+            return;
+        }
+        if(x->signal_mode != NTEL_BANG && x->mc) {
+            snprintf_zero(s, 256, "(multichannel signal) One channel per step");
+            return;
+        }
+        if(a >= x->n_steps || x->step_values == NULL) {
             return;
         }
-        snprintf_zero(s, 256, "Bang on step %d", x->steps[a]);
+        double step = ntel_step_value(x, a);
+        if(x->floats) {
+            double position = step / x->divider;
+            if(x->signal_mode == NTEL_IMPULSE) {
+                snprintf_zero(s, 256, "(signal) Impulse at phase %g", position);
+            } else if(x->signal_mode == NTEL_GATE) {
+                snprintf_zero(s, 256, "(signal) Gate open from phase %g", position);
+            } else {
+                snprintf_zero(s, 256, "Bang at phase %g", position);
+            }
+        } else if(x->signal_mode == NTEL_IMPULSE) {
+            snprintf_zero(s, 256, "(signal) Impulse at the end of step %ld (phase %g)", (long)step, fmod(step + 1, x->divider) / x->divider);
+        } else if(x->signal_mode == NTEL_GATE) {
+            snprintf_zero(s, 256, "(signal) Gate open during step %ld", (long)step);
+        } else {
+            snprintf_zero(s, 256, "Bang at the end of step %ld (phase %g)", (long)step, fmod(step + 1, x->divider) / x->divider);
+        }
     }
 }
 